@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for scratch data that lives until the next Reset(), such as the
+// arrays a renderer needs for one frame. Allocations are carved out of blocks
+// that are kept across resets; after a frame that spilled into several blocks,
+// Reset() replaces them with one block as large as all of them, so a steady
+// workload allocates from the heap only in its first frames. Nothing is
+// destroyed, which restricts it to trivially destructible types. Not thread
+// safe: one arena per thread.
+class Arena
+{
+public:
+    static constexpr size_t kAlignment = 64; // of every block, the most an allocation may ask for
+    static constexpr size_t kMinBlockSize = 64 * 1024;
+
+    // Scratch allocations made while a Scope is alive are released when it
+    // ends, for data that lives shorter than the frame.
+    class Scope
+    {
+    public:
+        explicit Scope(Arena& arena) : arena(arena), block(arena.current), offset(arena.offset) {}
+        ~Scope()
+        {
+            arena.current = block;
+            arena.offset = offset;
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Arena& arena;
+        size_t block, offset;
+    };
+
+    // n value-initialized Ts, valid until the next Reset()
+    template <typename T>
+    T* Allocate(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is released without destructors");
+        static_assert(alignof(T) <= kAlignment, "over-aligned type");
+        T* p = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+        std::uninitialized_value_construct_n(p, n);
+        return p;
+    }
+
+    // releases every allocation; the memory is kept for the next ones
+    void Reset()
+    {
+        if (blocks.size() > 1)
+        {
+            size_t total = 0;
+            for (const Block& b : blocks)
+                total += b.size;
+            blocks.clear();
+            addBlock(total);
+        }
+        current = 0;
+        offset = 0;
+    }
+
+    // bytes held in blocks
+    [[nodiscard]] size_t capacity() const
+    {
+        size_t total = 0;
+        for (const Block& b : blocks)
+            total += b.size;
+        return total;
+    }
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(std::byte* p) const { ::operator delete(p, std::align_val_t(kAlignment)); }
+    };
+    struct Block
+    {
+        std::unique_ptr<std::byte, AlignedDelete> data;
+        size_t size;
+    };
+
+    void* allocate(size_t bytes, size_t align)
+    {
+        for (;; ++current, offset = 0)
+        {
+            if (current == blocks.size())
+                addBlock(std::max({kMinBlockSize, bytes, blocks.empty() ? 0 : 2 * blocks.back().size}));
+            const size_t start = (offset + align - 1) / align * align;
+            if (start + bytes <= blocks[current].size)
+            {
+                offset = start + bytes;
+                return blocks[current].data.get() + start;
+            }
+        }
+    }
+
+    void addBlock(size_t size)
+    {
+        blocks.push_back({std::unique_ptr<std::byte, AlignedDelete>(
+                              static_cast<std::byte*>(::operator new(size, std::align_val_t(kAlignment)))),
+                          size});
+    }
+
+    std::vector<Block> blocks;
+    size_t current = 0; // block allocations are carved from
+    size_t offset = 0;  // first free byte in it
+};
@@ -0,0 +1,784 @@
+#pragma once
+
+#include "Bounds3.hpp"
+#include "RayPacket.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Read-only view of a contiguous array owned elsewhere.
+template <typename T>
+class ArrayView
+{
+public:
+    ArrayView() = default;
+    ArrayView(const T* d, size_t n)
+        : ptr(d)
+        , count(n)
+    {}
+
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+
+private:
+    const T* ptr = nullptr;
+    size_t count = 0;
+};
+
+// Node of a flattened BVH. Nodes are laid out depth first: the first child of an
+// interior node immediately follows it, the second child lives at `offset`.
+struct LinearBVHNode
+{
+    Bounds3 bounds;
+    uint32_t offset;      // leaf: first entry in primIndices, interior: second child
+    uint16_t nPrimitives; // 0 for interior nodes
+    uint8_t axis;         // split axis of interior nodes
+};
+
+// SAH-built bounding volume hierarchy over an arbitrary set of primitives, given
+// only by their bounds. What a primitive is, and how it is intersected, is left to
+// the caller of Intersect(), so the same tree serves objects and triangles alike.
+class BVH
+{
+public:
+    // entries of the traversal stack, which bounds the depth of a tree
+    static constexpr int kMaxDepth = 64;
+
+    BVH() = default;
+
+    // Callers that test the primitives of a leaf testWidth at a time (a SIMD
+    // kernel) give that width and what one such test costs relative to a single
+    // primitive test, for the SAH to weigh leaves by (a node visit costs 0.125).
+    explicit BVH(const std::vector<Bounds3>& primBounds, int maxPrimsInNode = 4, int testWidth = 1,
+                 float testCost = 1)
+        : maxPrimsInNode(std::min(maxPrimsInNode, 255))
+        , testWidth(std::max(testWidth, 1))
+        , testCost(testCost)
+    {
+        if (primBounds.empty())
+            return;
+        std::vector<BVHPrimitiveInfo> primitiveInfo(primBounds.size());
+        for (uint32_t i = 0; i < primBounds.size(); ++i)
+            primitiveInfo[i] = {i, primBounds[i], primBounds[i].Centroid()};
+        primStorage.reserve(primBounds.size());
+        nodeStorage.reserve(2 * primBounds.size());
+        recursiveBuild(primitiveInfo, 0, primitiveInfo.size());
+        syncViews();
+        recordQuality(0, nodeStorage.size());
+    }
+
+    // Uses a tree built elsewhere (a mapped scene cache) in place. The arrays are
+    // not copied and must outlive the BVH.
+    static BVH Adopt(const LinearBVHNode* nodes, size_t numNodes, const uint32_t* primIndices, size_t numPrims)
+    {
+        BVH bvh;
+        bvh.nodes = ArrayView<LinearBVHNode>(nodes, numNodes);
+        bvh.primIndices = ArrayView<uint32_t>(primIndices, numPrims);
+        return bvh;
+    }
+
+    // Whether nodes and primIndices form a tree Adopt() can traverse safely: each
+    // node reached once from the root, children after their parent and inside
+    // the array, leaves inside primIndices, every primitive index below numPrims
+    // and no path deeper than the traversal stack. One pass over both arrays.
+    static bool IsValid(const LinearBVHNode* nodes, size_t numNodes, const uint32_t* primIndices, size_t numPrims)
+    {
+        for (size_t i = 0; i < numPrims; ++i)
+            if (primIndices[i] >= numPrims)
+                return false;
+        if (numNodes == 0)
+            return true;
+        std::vector<char> reached(numNodes, 0);
+        std::vector<std::pair<uint32_t, int> > stack = {{0, 0}};
+        while (!stack.empty())
+        {
+            const auto [n, depth] = stack.back();
+            stack.pop_back();
+            if (reached[n]++)
+                return false;
+            const LinearBVHNode& node = nodes[n];
+            if (node.nPrimitives > 0)
+            {
+                if ((uint64_t)node.offset + node.nPrimitives > numPrims)
+                    return false;
+                continue;
+            }
+            if (node.axis > 2 || depth + 1 > kMaxDepth || n + 1 >= numNodes || node.offset <= n + 1 ||
+                node.offset >= numNodes)
+                return false;
+            stack.push_back({n + 1, depth + 1});
+            stack.push_back({node.offset, depth + 1});
+        }
+        return true;
+    }
+
+    // moving keeps the storage buffers, and with them the views, valid
+    BVH(BVH&&) = default;
+    BVH& operator=(BVH&&) = default;
+    BVH(const BVH&) = delete;
+    BVH& operator=(const BVH&) = delete;
+
+    bool empty() const { return nodes.empty(); }
+    Bounds3 WorldBound() const { return nodes.empty() ? Bounds3() : nodes[0].bounds; }
+
+    ArrayView<LinearBVHNode> get_nodes() const { return nodes; }
+    ArrayView<uint32_t> get_prim_indices() const { return primIndices; }
+
+    // Refits the boxes to moved primitives, keeping the topology: primBounds
+    // holds the current bounds of every primitive, by the index it was built
+    // with. An adopted tree is copied first.
+    void Refit(const std::vector<Bounds3>& primBounds)
+    {
+        makeOwned();
+        for (size_t n = nodeStorage.size(); n-- > 0;)
+            refitNode(n, primBounds);
+    }
+
+    // Same for only the primitives in changed: their leaves and the ancestors of
+    // those leaves are refitted bottom up.
+    void Refit(const std::vector<Bounds3>& primBounds, const std::vector<uint32_t>& changed)
+    {
+        makeOwned();
+        if (parents.empty())
+            buildParents();
+        for (uint32_t prim : changed)
+            for (uint32_t n = leafOf[prim];; n = parents[n])
+            {
+                refitNode(n, primBounds);
+                if (n == 0)
+                    break;
+            }
+    }
+
+    // SAH cost of the tree with its current boxes, relative to the root's area:
+    // the expected primitive tests plus node visits of a random ray.
+    float SahCost() const
+    {
+        if (nodes.empty())
+            return 0;
+        std::vector<float> cost = subtreeCosts();
+        return cost[0] / std::max(nodes[0].bounds.SurfaceArea(), 1e-20f);
+    }
+
+    // Rebuilds in place the subtrees whose SAH cost grew past threshold times
+    // their cost when built, after Refit() or Insert(), and returns how many were
+    // rebuilt. On every path from the root the first degraded node is rebuilt:
+    // costs are diluted towards the root, so a local motion degrades and rebuilds
+    // a local subtree, while primitives scattered across the scene degrade the
+    // root and rebuild everything. Reorders get_prim_indices() within the
+    // rebuilt subtrees.
+    int RebuildDegraded(const std::vector<Bounds3>& primBounds, float threshold = 1.5f)
+    {
+        if (nodes.empty())
+            return 0;
+        makeOwned();
+        const std::vector<float> cost = subtreeCosts();
+        std::vector<uint32_t> rebuild;
+        std::vector<uint32_t> stack = {0};
+        while (!stack.empty())
+        {
+            const uint32_t n = stack.back();
+            stack.pop_back();
+            const LinearBVHNode& node = nodeStorage[n];
+            if (cost[n] > threshold * quality[n].cost)
+            {
+                rebuild.push_back(n);
+            }
+            else if (node.nPrimitives == 0)
+            {
+                stack.push_back(node.offset);
+                stack.push_back(n + 1);
+            }
+        }
+        // later subtrees first, so the splices keep the earlier indices valid
+        std::sort(rebuild.begin(), rebuild.end(), std::greater<uint32_t>());
+        for (uint32_t n : rebuild)
+            rebuildSubtree(n, primBounds);
+        return (int)rebuild.size();
+    }
+
+    // Adds the primitives prims, with bounds primBounds[prim], without a rebuild.
+    // Each joins the leaf reached by always taking the child whose box grows
+    // least, and the boxes on the way are grown to cover it. The leaves' costs
+    // grow with them, which RebuildDegraded() corrects; only leaves that
+    // overflow are split at once.
+    void Insert(const std::vector<uint32_t>& prims, const std::vector<Bounds3>& primBounds)
+    {
+        if (prims.empty())
+            return;
+        makeOwned();
+        if (nodeStorage.empty())
+        {
+            buildFrom(prims, primBounds);
+            return;
+        }
+        std::vector<std::vector<uint32_t> > added(nodeStorage.size());
+        for (uint32_t prim : prims)
+        {
+            const Bounds3& bounds = primBounds[prim];
+            uint32_t n = 0;
+            while (true)
+            {
+                LinearBVHNode& node = nodeStorage[n];
+                node.bounds = Union(node.bounds, bounds);
+                if (node.nPrimitives > 0)
+                    break;
+                auto growth = [&](uint32_t c) {
+                    return Union(nodeStorage[c].bounds, bounds).SurfaceArea() - nodeStorage[c].bounds.SurfaceArea();
+                };
+                n = growth(n + 1) <= growth(node.offset) ? n + 1 : node.offset;
+            }
+            added[n].push_back(prim);
+        }
+        // leaves own consecutive ranges in node order; lay them out again with the additions
+        std::vector<uint32_t> storage;
+        storage.reserve(primStorage.size() + prims.size());
+        struct Overflow
+        {
+            uint32_t node, first, count;
+        };
+        std::vector<Overflow> overflowing;
+        for (uint32_t n = 0; n < nodeStorage.size(); ++n)
+        {
+            LinearBVHNode& node = nodeStorage[n];
+            if (node.nPrimitives == 0)
+                continue;
+            const uint32_t first = storage.size();
+            storage.insert(storage.end(), primStorage.begin() + node.offset,
+                           primStorage.begin() + node.offset + node.nPrimitives);
+            const size_t count = node.nPrimitives + added[n].size();
+            storage.insert(storage.end(), added[n].begin(), added[n].end());
+            node.offset = first;
+            node.nPrimitives = std::min<size_t>(count, 255);
+            if (count > 255)
+                overflowing.push_back({n, first, (uint32_t)count});
+        }
+        primStorage = std::move(storage);
+        parents.clear();
+        syncViews();
+        for (auto o = overflowing.rbegin(); o != overflowing.rend(); ++o)
+            rebuildRange(o->node, o->node + 1, o->first, o->first + o->count, primBounds);
+    }
+
+    // Front-to-back traversal. intersectPrim(primIndex, tMax) tests one primitive,
+    // shrinks tMax on a closer hit and returns whether it did; nodes entered beyond
+    // the current tMax are culled by the slab test.
+    template <typename IntersectPrim>
+    bool Intersect(const Vector3f& orig, const Vector3f& dir, float& tMax, IntersectPrim&& intersectPrim) const
+    {
+        return IntersectLeaves(orig, dir, tMax, [&](uint32_t first, uint32_t count, float& t) {
+            bool hit = false;
+            for (uint32_t i = first; i < first + count; ++i)
+                if (intersectPrim(primIndices[i], t))
+                    hit = true;
+            return hit;
+        });
+    }
+
+    // Same traversal, handing whole leaves to intersectLeaf(first, count, tMax):
+    // the leaf holds get_prim_indices()[first, first + count). Lets callers keep
+    // primitive data in leaf order and test a leaf in one go.
+    template <typename IntersectLeaf>
+    bool IntersectLeaves(const Vector3f& orig, const Vector3f& dir, float& tMax, IntersectLeaf&& intersectLeaf) const
+    {
+        if (nodes.empty())
+            return false;
+        Vector3f invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+        const bool dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+
+        bool hit = false;
+        uint32_t toVisit[kMaxDepth];
+        int toVisitOffset = 0;
+        uint32_t current = 0;
+        while (true)
+        {
+            const LinearBVHNode& node = nodes[current];
+            RT_STAT(BvhNodes);
+            float tEntry;
+            if (node.bounds.IntersectP(orig, invDir, tMax, tEntry))
+            {
+                if (node.nPrimitives > 0)
+                {
+                    if (intersectLeaf(node.offset, node.nPrimitives, tMax))
+                        hit = true;
+                    if (toVisitOffset == 0)
+                        break;
+                    current = toVisit[--toVisitOffset];
+                }
+                else if (dirIsNeg[node.axis])
+                {
+                    toVisit[toVisitOffset++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    toVisit[toVisitOffset++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return hit;
+    }
+
+    // Any-hit traversal for shadow rays: true as soon as occludedPrim(primIndex)
+    // reports a hit closer than tMax. Child order does not matter here.
+    template <typename OccludedPrim>
+    bool Occluded(const Vector3f& orig, const Vector3f& dir, float tMax, OccludedPrim&& occludedPrim) const
+    {
+        return OccludedLeaves(orig, dir, tMax, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; ++i)
+                if (occludedPrim(primIndices[i]))
+                    return true;
+            return false;
+        });
+    }
+
+    // leaf form of Occluded(), see IntersectLeaves()
+    template <typename OccludedLeaf>
+    bool OccludedLeaves(const Vector3f& orig, const Vector3f& dir, float tMax, OccludedLeaf&& occludedLeaf) const
+    {
+        if (nodes.empty())
+            return false;
+        Vector3f invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+        uint32_t toVisit[kMaxDepth];
+        int toVisitOffset = 0;
+        uint32_t current = 0;
+        while (true)
+        {
+            const LinearBVHNode& node = nodes[current];
+            RT_STAT(BvhNodes);
+            float tEntry;
+            if (node.bounds.IntersectP(orig, invDir, tMax, tEntry))
+            {
+                if (node.nPrimitives > 0)
+                {
+                    if (occludedLeaf(node.offset, node.nPrimitives))
+                        return true;
+                    if (toVisitOffset == 0)
+                        break;
+                    current = toVisit[--toVisitOffset];
+                }
+                else
+                {
+                    toVisit[toVisitOffset++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return false;
+    }
+
+    // Point query: hands every leaf whose bounds contain p to visitLeaf(first,
+    // count), as in IntersectLeaves(), in a fixed depth first order.
+    template <typename VisitLeaf>
+    void VisitLeavesContaining(const Vector3f& p, VisitLeaf&& visitLeaf) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t toVisit[kMaxDepth];
+        int toVisitOffset = 0;
+        uint32_t current = 0;
+        while (true)
+        {
+            const LinearBVHNode& node = nodes[current];
+            RT_STAT(BvhNodes);
+            if (node.bounds.Contains(p))
+            {
+                if (node.nPrimitives > 0)
+                {
+                    visitLeaf(node.offset, node.nPrimitives);
+                    if (toVisitOffset == 0)
+                        break;
+                    current = toVisit[--toVisitOffset];
+                }
+                else
+                {
+                    toVisit[toVisitOffset++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+    }
+
+    // Packet traversal for coherent rays. A node is entered when any lane of
+    // activeMask hits its bounds; children are ordered by the first active lane.
+    // intersectPrim(primIndex, laneMask, tMax) returns the lanes it hit.
+    template <typename IntersectPrim>
+    int IntersectPacket(const RayPacket4& rays, int activeMask, float4& tMax, IntersectPrim&& intersectPrim) const
+    {
+        return IntersectPacketLeaves(rays, activeMask, tMax, [&](uint32_t first, uint32_t count, int mask, float4& t) {
+            int hits = 0;
+            for (uint32_t i = first; i < first + count; ++i)
+                hits |= intersectPrim(primIndices[i], mask, t);
+            return hits;
+        });
+    }
+
+    // leaf form of IntersectPacket(), see IntersectLeaves()
+    template <typename IntersectLeaf>
+    int IntersectPacketLeaves(const RayPacket4& rays, int activeMask, float4& tMax, IntersectLeaf&& intersectLeaf) const
+    {
+        if (nodes.empty() || activeMask == 0)
+            return 0;
+        int lane = 0;
+        while (!(activeMask & (1 << lane)))
+            ++lane;
+        const bool dirIsNeg[3] = {rays.invDir.x[lane] < 0, rays.invDir.y[lane] < 0, rays.invDir.z[lane] < 0};
+
+        int hitMask = 0;
+        uint32_t toVisit[kMaxDepth];
+        int toVisitOffset = 0;
+        uint32_t current = 0;
+        while (true)
+        {
+            const LinearBVHNode& node = nodes[current];
+            RT_STAT(BvhNodes);
+            int mask = IntersectP(node.bounds, rays, tMax) & activeMask;
+            if (mask)
+            {
+                if (node.nPrimitives > 0)
+                {
+                    hitMask |= intersectLeaf(node.offset, node.nPrimitives, mask, tMax);
+                    if (toVisitOffset == 0)
+                        break;
+                    current = toVisit[--toVisitOffset];
+                }
+                else if (dirIsNeg[node.axis])
+                {
+                    toVisit[toVisitOffset++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    toVisit[toVisitOffset++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (toVisitOffset == 0)
+                    break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return hitMask;
+    }
+
+private:
+    struct BVHPrimitiveInfo
+    {
+        uint32_t index;
+        Bounds3 bounds;
+        Vector3f centroid;
+    };
+
+    static constexpr int kBuckets = 12;
+
+    // the cost of testing a leaf of n primitives
+    float leafCost(size_t n) const { return (float)((n + testWidth - 1) / testWidth) * testCost; }
+
+    uint32_t makeLeaf(const std::vector<BVHPrimitiveInfo>& info, size_t start, size_t end, uint32_t nodeIndex)
+    {
+        nodeStorage[nodeIndex].offset = primStorage.size();
+        nodeStorage[nodeIndex].nPrimitives = end - start;
+        for (size_t i = start; i < end; ++i)
+            primStorage.push_back(info[i].index);
+        return nodeIndex;
+    }
+
+    uint32_t recursiveBuild(std::vector<BVHPrimitiveInfo>& info, size_t start, size_t end)
+    {
+        uint32_t nodeIndex = nodeStorage.size();
+        nodeStorage.emplace_back();
+
+        Bounds3 bounds, centroidBounds;
+        for (size_t i = start; i < end; ++i)
+        {
+            bounds = Union(bounds, info[i].bounds);
+            centroidBounds = Union(centroidBounds, info[i].centroid);
+        }
+        nodeStorage[nodeIndex].bounds = bounds;
+
+        size_t nPrimitives = end - start;
+        int dim = centroidBounds.maxExtent();
+        if (nPrimitives == 1 || centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+        {
+            if (nPrimitives <= 255)
+                return makeLeaf(info, start, end, nodeIndex);
+            // coincident centroids: no split plane separates them, halve the range instead
+            size_t mid = (start + end) / 2;
+            return makeInterior(info, start, mid, end, dim, nodeIndex);
+        }
+
+        size_t mid;
+        if (nPrimitives <= 2 && testWidth == 1)
+        {
+            mid = (start + end) / 2;
+            std::nth_element(&info[start], &info[mid], &info[end - 1] + 1,
+                             [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                                 return a.centroid[dim] < b.centroid[dim];
+                             });
+        }
+        else
+        {
+            // bucketed surface area heuristic along the widest centroid axis
+            struct Bucket
+            {
+                int count = 0;
+                Bounds3 bounds;
+            } buckets[kBuckets];
+            auto bucketOf = [&](const BVHPrimitiveInfo& p) {
+                int b = kBuckets * centroidBounds.Offset(p.centroid)[dim];
+                return std::min(b, kBuckets - 1);
+            };
+            for (size_t i = start; i < end; ++i)
+            {
+                int b = bucketOf(info[i]);
+                buckets[b].count++;
+                buckets[b].bounds = Union(buckets[b].bounds, info[i].bounds);
+            }
+
+            float cost[kBuckets - 1];
+            for (int i = 0; i < kBuckets - 1; ++i)
+            {
+                Bounds3 b0, b1;
+                int count0 = 0, count1 = 0;
+                for (int j = 0; j <= i; ++j)
+                {
+                    b0 = Union(b0, buckets[j].bounds);
+                    count0 += buckets[j].count;
+                }
+                for (int j = i + 1; j < kBuckets; ++j)
+                {
+                    b1 = Union(b1, buckets[j].bounds);
+                    count1 += buckets[j].count;
+                }
+                cost[i] = 0.125f + (leafCost(count0) * b0.SurfaceArea() + leafCost(count1) * b1.SurfaceArea()) /
+                                       bounds.SurfaceArea();
+            }
+
+            int minCostSplitBucket = 0;
+            for (int i = 1; i < kBuckets - 1; ++i)
+                if (cost[i] < cost[minCostSplitBucket])
+                    minCostSplitBucket = i;
+
+            if (nPrimitives <= (size_t)maxPrimsInNode && cost[minCostSplitBucket] >= leafCost(nPrimitives))
+                return makeLeaf(info, start, end, nodeIndex);
+
+            BVHPrimitiveInfo* pmid = std::partition(&info[start], &info[end - 1] + 1,
+                                                    [&](const BVHPrimitiveInfo& p) {
+                                                        return bucketOf(p) <= minCostSplitBucket;
+                                                    });
+            mid = pmid - &info[0];
+        }
+        return makeInterior(info, start, mid, end, dim, nodeIndex);
+    }
+
+    uint32_t makeInterior(std::vector<BVHPrimitiveInfo>& info, size_t start, size_t mid, size_t end, int dim,
+                          uint32_t nodeIndex)
+    {
+        nodeStorage[nodeIndex].nPrimitives = 0;
+        nodeStorage[nodeIndex].axis = dim;
+        recursiveBuild(info, start, mid);
+        uint32_t secondChild = recursiveBuild(info, mid, end);
+        nodeStorage[nodeIndex].offset = secondChild;
+        return nodeIndex;
+    }
+
+    // what a node cost and covered when it was built, to tell when refits degraded it
+    struct NodeQuality
+    {
+        float area;
+        float cost;
+    };
+
+    static constexpr float kTraversalCost = 0.125f;
+
+    void syncViews()
+    {
+        nodes = ArrayView<LinearBVHNode>(nodeStorage.data(), nodeStorage.size());
+        primIndices = ArrayView<uint32_t>(primStorage.data(), primStorage.size());
+    }
+
+    // copies an adopted tree into the storage buffers, which the updates modify
+    void makeOwned()
+    {
+        if (nodeStorage.size() != nodes.size())
+        {
+            nodeStorage.assign(nodes.begin(), nodes.end());
+            primStorage.assign(primIndices.begin(), primIndices.end());
+            syncViews();
+        }
+        if (quality.size() != nodeStorage.size())
+        {
+            quality.resize(nodeStorage.size());
+            recordQuality(0, nodeStorage.size());
+        }
+    }
+
+    // Unnormalized SAH cost of every subtree: area times primitives for a leaf,
+    // area times the traversal cost plus the children's costs otherwise. Children
+    // follow their parent in the array, so one backwards pass does it.
+    std::vector<float> subtreeCosts() const { return subtreeCosts(0, nodes.size()); }
+    std::vector<float> subtreeCosts(size_t first, size_t end) const
+    {
+        std::vector<float> cost(end);
+        for (size_t n = end; n-- > first;)
+        {
+            const LinearBVHNode& node = nodes[n];
+            const float area = node.bounds.SurfaceArea();
+            cost[n] = node.nPrimitives > 0 ? area * leafCost(node.nPrimitives)
+                                           : area * kTraversalCost + cost[n + 1] + cost[node.offset];
+        }
+        return cost;
+    }
+
+    // the subtree's current cost becomes the reference for degradation
+    void recordQuality(size_t first, size_t end)
+    {
+        quality.resize(nodeStorage.size());
+        const std::vector<float> cost = subtreeCosts(first, end);
+        for (size_t n = first; n < end; ++n)
+            quality[n] = {nodeStorage[n].bounds.SurfaceArea(), cost[n]};
+    }
+
+    void refitNode(size_t n, const std::vector<Bounds3>& primBounds)
+    {
+        LinearBVHNode& node = nodeStorage[n];
+        if (node.nPrimitives > 0)
+        {
+            Bounds3 bounds;
+            for (uint32_t i = node.offset; i < node.offset + node.nPrimitives; ++i)
+                bounds = Union(bounds, primBounds[primStorage[i]]);
+            node.bounds = bounds;
+        }
+        else
+        {
+            node.bounds = Union(nodeStorage[n + 1].bounds, nodeStorage[node.offset].bounds);
+        }
+    }
+
+    // parent of every node and leaf of every primitive, for partial refits;
+    // cleared by anything that moves nodes or primitives
+    void buildParents()
+    {
+        parents.assign(nodeStorage.size(), 0);
+        uint32_t numPrims = 0;
+        for (uint32_t prim : primStorage)
+            numPrims = std::max(numPrims, prim + 1);
+        leafOf.assign(numPrims, 0);
+        for (uint32_t n = 0; n < nodeStorage.size(); ++n)
+        {
+            const LinearBVHNode& node = nodeStorage[n];
+            if (node.nPrimitives > 0)
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.nPrimitives; ++i)
+                    leafOf[primStorage[i]] = n;
+            }
+            else
+            {
+                parents[n + 1] = n;
+                parents[node.offset] = n;
+            }
+        }
+    }
+
+    // a new tree over only the primitives prims
+    void buildFrom(const std::vector<uint32_t>& prims, const std::vector<Bounds3>& primBounds)
+    {
+        std::vector<BVHPrimitiveInfo> info;
+        info.reserve(prims.size());
+        for (uint32_t prim : prims)
+            info.push_back({prim, primBounds[prim], primBounds[prim].Centroid()});
+        nodeStorage.clear();
+        primStorage.clear();
+        recursiveBuild(info, 0, info.size());
+        parents.clear();
+        syncViews();
+        recordQuality(0, nodeStorage.size());
+    }
+
+    // Builds the subtree at root afresh over the same primitives and splices it
+    // into the arrays in place of the old one. The primitives keep their range of
+    // primIndices; the nodes after the subtree move by the change in its size.
+    void rebuildSubtree(uint32_t root, const std::vector<Bounds3>& primBounds)
+    {
+        uint32_t last = root, first = root;
+        while (nodeStorage[last].nPrimitives == 0)
+            last = nodeStorage[last].offset;
+        while (nodeStorage[first].nPrimitives == 0)
+            ++first;
+        rebuildRange(root, last + 1, nodeStorage[first].offset,
+                     nodeStorage[last].offset + nodeStorage[last].nPrimitives, primBounds);
+    }
+
+    // builds the primitives primIndices[primBegin, primEnd) in place of the nodes [root, end)
+    void rebuildRange(uint32_t root, uint32_t end, uint32_t primBegin, uint32_t primEnd,
+                      const std::vector<Bounds3>& primBounds)
+    {
+        std::vector<BVHPrimitiveInfo> info;
+        info.reserve(primEnd - primBegin);
+        for (uint32_t i = primBegin; i < primEnd; ++i)
+        {
+            const uint32_t prim = primStorage[i];
+            info.push_back({prim, primBounds[prim], primBounds[prim].Centroid()});
+        }
+        BVH sub;
+        sub.maxPrimsInNode = maxPrimsInNode;
+        sub.testWidth = testWidth;
+        sub.testCost = testCost;
+        sub.recursiveBuild(info, 0, info.size());
+        for (LinearBVHNode& node : sub.nodeStorage)
+            node.offset += node.nPrimitives > 0 ? primBegin : root;
+        std::copy(sub.primStorage.begin(), sub.primStorage.end(), primStorage.begin() + primBegin);
+
+        const int64_t delta = (int64_t)sub.nodeStorage.size() - (end - root);
+        for (uint32_t n = 0; n < nodeStorage.size(); ++n)
+            if ((n < root || n >= end) && nodeStorage[n].nPrimitives == 0 && nodeStorage[n].offset >= end)
+                nodeStorage[n].offset += delta;
+        nodeStorage.erase(nodeStorage.begin() + root, nodeStorage.begin() + end);
+        nodeStorage.insert(nodeStorage.begin() + root, sub.nodeStorage.begin(), sub.nodeStorage.end());
+        quality.erase(quality.begin() + root, quality.begin() + end);
+        quality.insert(quality.begin() + root, sub.nodeStorage.size(), NodeQuality());
+        parents.clear();
+        syncViews();
+        recordQuality(root, root + sub.nodeStorage.size());
+    }
+
+    int maxPrimsInNode = 4;
+    int testWidth = 1;
+    float testCost = 1;
+    // what nodes and primIndices point into, unless they are adopted
+    std::vector<LinearBVHNode> nodeStorage;
+    std::vector<uint32_t> primStorage;
+    ArrayView<LinearBVHNode> nodes;
+    ArrayView<uint32_t> primIndices;
+    std::vector<NodeQuality> quality; // per node, kept with the storage
+    std::vector<uint32_t> parents, leafOf;
+};
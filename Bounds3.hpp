@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Vector.hpp"
+
+#include <algorithm>
+#include <limits>
+
+// Axis-aligned bounding box used by the acceleration structures.
+class Bounds3
+{
+public:
+    Bounds3()
+        : pMin(std::numeric_limits<float>::max())
+        , pMax(std::numeric_limits<float>::lowest())
+    {}
+    explicit Bounds3(const Vector3f& p)
+        : pMin(p)
+        , pMax(p)
+    {}
+    Bounds3(const Vector3f& p1, const Vector3f& p2)
+        : pMin(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z))
+        , pMax(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z))
+    {}
+
+    Vector3f Diagonal() const { return pMax - pMin; }
+    Vector3f Centroid() const { return 0.5f * (pMin + pMax); }
+
+    // 0, 1, 2 for the x, y, z axis with the largest extent
+    int maxExtent() const
+    {
+        Vector3f d = Diagonal();
+        if (d.x > d.y && d.x > d.z)
+            return 0;
+        return d.y > d.z ? 1 : 2;
+    }
+
+    float SurfaceArea() const
+    {
+        if (pMin.x > pMax.x)
+            return 0;
+        Vector3f d = Diagonal();
+        return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+
+    bool Contains(const Vector3f& p) const
+    {
+        return p.x >= pMin.x && p.x <= pMax.x && p.y >= pMin.y && p.y <= pMax.y && p.z >= pMin.z && p.z <= pMax.z;
+    }
+
+    // position of p relative to the box, (0,0,0) at pMin and (1,1,1) at pMax
+    Vector3f Offset(const Vector3f& p) const
+    {
+        Vector3f o = p - pMin;
+        if (pMax.x > pMin.x) o.x /= pMax.x - pMin.x;
+        if (pMax.y > pMin.y) o.y /= pMax.y - pMin.y;
+        if (pMax.z > pMin.z) o.z /= pMax.z - pMin.z;
+        return o;
+    }
+
+    // Slab test against [0, tMax]. invDir holds 1/dir per component; NaN slabs
+    // (ray origin on a slab plane of a flat box) fall through as a hit, which
+    // keeps the test conservative.
+    bool IntersectP(const Vector3f& orig, const Vector3f& invDir, float tMax, float& tEntry) const
+    {
+        float t0 = 0, t1 = tMax;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float tNear = (pMin[axis] - orig[axis]) * invDir[axis];
+            float tFar = (pMax[axis] - orig[axis]) * invDir[axis];
+            if (tNear > tFar)
+                std::swap(tNear, tFar);
+            // widen against rounding so hits exactly on a face are not culled
+            tFar *= 1 + 2 * kSlabGamma;
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+            if (t0 > t1)
+                return false;
+        }
+        tEntry = t0;
+        return true;
+    }
+
+    Vector3f pMin, pMax;
+
+    // gamma(3) bound on the relative error of the slab computation
+    static constexpr float kSlabGamma =
+        3 * std::numeric_limits<float>::epsilon() * 0.5f / (1 - 3 * std::numeric_limits<float>::epsilon() * 0.5f);
+};
+
+inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
+{
+    Bounds3 ret;
+    ret.pMin = Vector3f(std::min(b1.pMin.x, b2.pMin.x), std::min(b1.pMin.y, b2.pMin.y),
+                        std::min(b1.pMin.z, b2.pMin.z));
+    ret.pMax = Vector3f(std::max(b1.pMax.x, b2.pMax.x), std::max(b1.pMax.y, b2.pMax.y),
+                        std::max(b1.pMax.z, b2.pMax.z));
+    return ret;
+}
+
+inline Bounds3 Union(const Bounds3& b, const Vector3f& p)
+{
+    return Union(b, Bounds3(p));
+}
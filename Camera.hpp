@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Vector.hpp"
+
+#include <cmath>
+
+// Thin lens camera: the eye, an orthonormal view basis, the vertical field of
+// view and the lens. A camera ray leaves the eye through the point (x, y) of
+// the image plane one unit along forward, x along right and y along up; the
+// Renderer scales x and y by fov. With an aperture the ray starts on the lens
+// instead and meets the pinhole ray at focusDistance along forward, so only
+// that plane is sharp. The default is a pinhole looking down -z with +y up.
+class Camera
+{
+public:
+    Camera() = default;
+
+    // aims the camera from eye at target, up fixing the image's vertical; the
+    // field of view and lens are kept
+    void LookAt(const Vector3f& eye, const Vector3f& target, const Vector3f& up = Vector3f(0, 1, 0))
+    {
+        const Vector3f f = normalize(target - eye);
+        const Vector3f r = crossProduct(f, up);
+        if (!(dotProduct(r, r) >= 1e-12f))
+            throw "camera error:up is parallel to the view direction";
+        position = eye;
+        forward = f;
+        right = normalize(r);
+        this->up = crossProduct(right, forward);
+    }
+
+    Vector3f Direction(float x, float y) const { return normalize(right * x + up * y + forward); }
+
+    // The ray through (x, y). lens is a point of the unit square, mapped onto the
+    // aperture; pinhole cameras ignore it.
+    void GenerateRay(float x, float y, const Vector2f& lens, Vector3f& orig, Vector3f& dir) const
+    {
+        dir = Direction(x, y);
+        orig = position;
+        if (aperture <= 0)
+            return;
+        const Vector3f focus = position + dir * (focusDistance / dotProduct(dir, forward));
+        const Vector2f disk = ConcentricDisk(lens) * (0.5f * aperture);
+        orig = position + right * disk.x + up * disk.y;
+        dir = normalize(focus - orig);
+    }
+
+    Vector3f position = Vector3f(0);
+    Vector3f forward = Vector3f(0, 0, -1);
+    Vector3f up = Vector3f(0, 1, 0);
+    Vector3f right = Vector3f(1, 0, 0);
+    float fov = 90;          // vertical, in degrees
+    float aperture = 0;      // lens diameter, 0 for a pinhole
+    float focusDistance = 1; // along forward
+
+private:
+    // Shirley and Chiu's area preserving map of the unit square onto the unit disk
+    static Vector2f ConcentricDisk(const Vector2f& u)
+    {
+        const float a = 2 * u.x - 1, b = 2 * u.y - 1;
+        if (a == 0 && b == 0)
+            return Vector2f(0, 0);
+        constexpr float kQuarterPi = 0.785398163f;
+        float r, phi;
+        if (std::abs(a) > std::abs(b))
+        {
+            r = a;
+            phi = kQuarterPi * (b / a);
+        }
+        else
+        {
+            r = b;
+            phi = 2 * kQuarterPi - kQuarterPi * (a / b);
+        }
+        return Vector2f(r * std::cos(phi), r * std::sin(phi));
+    }
+};
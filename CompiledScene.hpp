@@ -0,0 +1,366 @@
+#pragma once
+
+#include "BVH.hpp"
+#include "Instance.hpp"
+#include "Object.hpp"
+#include "Sphere.hpp"
+#include "SphereGroup.hpp"
+#include "Triangle.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class PrimitiveType : uint32_t
+{
+    Sphere,
+    Mesh,
+    SphereGroup,
+    Instance,
+    // any other Object subclass, tested through its virtual interface
+    Other,
+    // taken out by Remove(), never hit
+    Removed
+};
+
+struct PrimitiveRef
+{
+    PrimitiveType type;
+    uint32_t index; // into the array of its type
+};
+
+// What a sphere query needs, packed into 16 bytes.
+struct SphereRecord
+{
+    float center[3];
+    float radius2;
+};
+
+// Render-time form of the objects of a Scene. Primitives are packed into one
+// contiguous array per type and dispatched on a type tag, so the hot loops call
+// the sphere and mesh tests statically instead of through Object's vtable. The
+// references and the sphere records are stored in BVH leaf order, which makes a
+// leaf a linear walk through memory. The Objects stay the authoring form and
+// are still what a hit reports for shading.
+class CompiledScene
+{
+public:
+    explicit CompiledScene(const std::vector<std::unique_ptr<Object> >& objects, int maxPrimsInNode = 4)
+    {
+        primObjects.reserve(objects.size());
+        for (const auto& object : objects)
+            addPrim(object.get());
+        bvh = BVH(primBounds, maxPrimsInNode);
+        layoutLeaves();
+    }
+
+    // Follows the objects in changed to where they moved (their getBounds()
+    // changed), refitting the BVH bottom up and rebuilding the subtrees that
+    // degraded past rebuildThreshold (see BVH::RebuildDegraded()).
+    void Refit(const std::vector<Object*>& changed, float rebuildThreshold = 1.5f)
+    {
+        std::vector<uint32_t> prims;
+        for (const Object* object : changed)
+        {
+            auto it = primOf.find(object);
+            if (it == primOf.end())
+                continue;
+            const uint32_t prim = it->second;
+            primBounds[prim] = object->getBounds();
+            if (refsByPrim[prim].type == PrimitiveType::Sphere)
+            {
+                sphereByPrim[refsByPrim[prim].index] = record(static_cast<const Sphere&>(*object));
+                spheres[refs[slotOfPrim[prim]].index] = sphereByPrim[refsByPrim[prim].index];
+            }
+            prims.push_back(prim);
+        }
+        bvh.Refit(primBounds, prims);
+        if (bvh.RebuildDegraded(primBounds, rebuildThreshold))
+            layoutLeaves();
+    }
+
+    // adds objects without a rebuild, see BVH::Insert()
+    void Insert(const std::vector<Object*>& objects)
+    {
+        std::vector<uint32_t> prims;
+        for (Object* object : objects)
+            prims.push_back(addPrim(object));
+        bvh.Insert(prims, primBounds);
+        layoutLeaves();
+    }
+
+    // Stops testing object, before it is deleted. Its slot stays in its leaf with
+    // a point box until the next rebuild.
+    void Remove(const Object* object)
+    {
+        auto it = primOf.find(object);
+        if (it == primOf.end())
+            return;
+        const uint32_t prim = it->second;
+        primOf.erase(it);
+        refsByPrim[prim].type = PrimitiveType::Removed;
+        refs[slotOfPrim[prim]].type = PrimitiveType::Removed;
+        primObjects[prim] = nullptr;
+        primBounds[prim] = Bounds3(primBounds[prim].Centroid());
+        bvh.Refit(primBounds, {prim});
+    }
+
+    Bounds3 WorldBound() const { return bvh.WorldBound(); }
+    // of the scene BVH, to watch the quality of refits
+    float SahCost() const { return bvh.SahCost(); }
+
+    size_t get_num_spheres() const { return spheres.size(); }
+    size_t get_num_meshes() const { return meshes.size(); }
+    size_t get_num_sphere_groups() const { return sphereGroups.size(); }
+    size_t get_num_instances() const { return instances.size(); }
+    size_t get_num_others() const { return others.size(); }
+
+    // closest hit closer than tNear; on success fills the hit record and shrinks tNear
+    bool Intersect(const Vector3f& orig, const Vector3f& dir, float& tNear, uint32_t& index, Vector2f& uv,
+                   Object*& hitObj) const
+    {
+        return bvh.IntersectLeaves(orig, dir, tNear, [&](uint32_t first, uint32_t count, float& tMax) {
+            bool hit = false;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                float tNearK = kInfinity;
+                uint32_t indexK = 0;
+                Vector2f uvK;
+                countTests(refs[i], 1);
+                bool hitK = visit(refs[i], [&](const auto& prim) {
+                    return intersectPrim(prim, orig, dir, tNearK, indexK, uvK);
+                });
+                if (hitK && tNearK < tMax)
+                {
+                    tMax = tNearK;
+                    index = indexK;
+                    uv = uvK;
+                    hitObj = object(refs[i]);
+                    hit = true;
+                }
+            }
+            return hit;
+        });
+    }
+
+    // whether any object blocks the segment from orig to orig + tMax * dir
+    bool Occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+    {
+        return bvh.OccludedLeaves(orig, dir, tMax, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                countTests(refs[i], 1);
+                if (visit(refs[i], [&](const auto& prim) { return occludedPrim(prim, orig, dir, tMax); }))
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    // packet form of Intersect(); per lane results for the returned hit mask
+    int IntersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, uint32_t index[4], Vector2f uv[4],
+                        Object* hitObj[4]) const
+    {
+        return bvh.IntersectPacketLeaves(rays, activeMask, tNear,
+                                         [&](uint32_t first, uint32_t count, int mask, float4& tMax) {
+            int hitMask = 0;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                countTests(refs[i], count_lanes(mask));
+                int hits = visit(refs[i], [&](const auto& prim) {
+                    return intersectPrimPacket(prim, rays, mask, tMax, index, uv);
+                });
+                if (!hits)
+                    continue;
+                Object* hit = object(refs[i]);
+                for (int lane = 0; lane < RayPacket4::kSize; ++lane)
+                    if (hits & (1 << lane))
+                        hitObj[lane] = hit;
+                hitMask |= hits;
+            }
+            return hitMask;
+        });
+    }
+
+private:
+    // calls f with the SphereRecord, MeshTriangle, SphereGroup, MeshInstance or Object behind ref
+    template <typename F>
+    auto visit(const PrimitiveRef& ref, F&& f) const -> decltype(f(std::declval<const SphereRecord&>()))
+    {
+        switch (ref.type)
+        {
+        case PrimitiveType::Sphere:
+            return f(spheres[ref.index]);
+        case PrimitiveType::Mesh:
+            return f(*meshes[ref.index]);
+        case PrimitiveType::SphereGroup:
+            return f(*sphereGroups[ref.index]);
+        case PrimitiveType::Instance:
+            return f(*instances[ref.index]);
+        case PrimitiveType::Removed:
+            return {};
+        default:
+            return f(*others[ref.index]);
+        }
+    }
+
+    // counts lanes tests against ref for RT_STATS
+    static void countTests(const PrimitiveRef& ref, int lanes)
+    {
+        switch (ref.type)
+        {
+        case PrimitiveType::Sphere:
+            RT_STAT_ADD(SphereTests, lanes);
+            break;
+        case PrimitiveType::Mesh:
+        case PrimitiveType::SphereGroup:
+            RT_STAT_ADD(MeshTests, lanes);
+            break;
+        case PrimitiveType::Instance:
+            RT_STAT_ADD(InstanceTests, lanes);
+            break;
+        case PrimitiveType::Removed:
+            break;
+        default:
+            RT_STAT_ADD(OtherTests, lanes);
+        }
+    }
+
+    Object* object(const PrimitiveRef& ref) const
+    {
+        switch (ref.type)
+        {
+        case PrimitiveType::Sphere:
+            return sphereObjects[ref.index];
+        case PrimitiveType::Mesh:
+            return meshes[ref.index];
+        case PrimitiveType::SphereGroup:
+            return sphereGroups[ref.index];
+        case PrimitiveType::Instance:
+            return instances[ref.index];
+        case PrimitiveType::Removed:
+            return nullptr;
+        default:
+            return others[ref.index];
+        }
+    }
+
+    static SphereRecord record(const Sphere& sphere)
+    {
+        return {{sphere.center.x, sphere.center.y, sphere.center.z}, sphere.radius2};
+    }
+
+    // appends object to the per primitive and per type arrays; returns its primitive index
+    uint32_t addPrim(Object* object)
+    {
+        const uint32_t prim = primObjects.size();
+        primObjects.push_back(object);
+        primBounds.push_back(object->getBounds());
+        primOf[object] = prim;
+        if (auto* sphere = dynamic_cast<Sphere*>(object))
+        {
+            refsByPrim.push_back({PrimitiveType::Sphere, (uint32_t)sphereByPrim.size()});
+            sphereByPrim.push_back(record(*sphere));
+        }
+        else if (auto* mesh = dynamic_cast<MeshTriangle*>(object))
+        {
+            refsByPrim.push_back({PrimitiveType::Mesh, (uint32_t)meshes.size()});
+            meshes.push_back(mesh);
+        }
+        else if (auto* group = dynamic_cast<SphereGroup*>(object))
+        {
+            refsByPrim.push_back({PrimitiveType::SphereGroup, (uint32_t)sphereGroups.size()});
+            sphereGroups.push_back(group);
+        }
+        else if (auto* instance = dynamic_cast<MeshInstance*>(object))
+        {
+            refsByPrim.push_back({PrimitiveType::Instance, (uint32_t)instances.size()});
+            instances.push_back(instance);
+        }
+        else
+        {
+            refsByPrim.push_back({PrimitiveType::Other, (uint32_t)others.size()});
+            others.push_back(object);
+        }
+        return prim;
+    }
+
+    // Lays the references and sphere records out in the order the leaves reach
+    // them, renumbering the spheres; after every change to that order.
+    void layoutLeaves()
+    {
+        ArrayView<uint32_t> order = bvh.get_prim_indices();
+        refs.clear();
+        spheres.clear();
+        sphereObjects.clear();
+        slotOfPrim.resize(primObjects.size());
+        for (uint32_t prim : order)
+        {
+            PrimitiveRef ref = refsByPrim[prim];
+            if (ref.type == PrimitiveType::Sphere)
+            {
+                spheres.push_back(sphereByPrim[ref.index]);
+                sphereObjects.push_back(primObjects[prim]);
+                ref.index = (uint32_t)spheres.size() - 1;
+            }
+            slotOfPrim[prim] = refs.size();
+            refs.push_back(ref);
+        }
+    }
+
+    static Vector3f center(const SphereRecord& s) { return Vector3f(s.center[0], s.center[1], s.center[2]); }
+
+    static bool intersectPrim(const SphereRecord& s, const Vector3f& orig, const Vector3f& dir, float& tNear,
+                              uint32_t&, Vector2f&)
+    {
+        return raySphereIntersect(orig, dir, center(s), s.radius2, tNear);
+    }
+    // MeshTriangle, SphereGroup and MeshInstance are final, so their calls are resolved statically
+    template <typename T>
+    static bool intersectPrim(const T& object, const Vector3f& orig, const Vector3f& dir, float& tNear,
+                              uint32_t& index, Vector2f& uv)
+    {
+        return object.intersect(orig, dir, tNear, index, uv);
+    }
+
+    static bool occludedPrim(const SphereRecord& s, const Vector3f& orig, const Vector3f& dir, float tMax)
+    {
+        float t = kInfinity;
+        return raySphereIntersect(orig, dir, center(s), s.radius2, t) && t < tMax;
+    }
+    template <typename T>
+    static bool occludedPrim(const T& object, const Vector3f& orig, const Vector3f& dir, float tMax)
+    {
+        return object.occluded(orig, dir, tMax);
+    }
+
+    static int intersectPrimPacket(const SphereRecord& s, const RayPacket4& rays, int mask, float4& tNear,
+                                   uint32_t*, Vector2f*)
+    {
+        return raySphereIntersectPacket(rays, mask, tNear, center(s), s.radius2);
+    }
+    template <typename T>
+    static int intersectPrimPacket(const T& object, const RayPacket4& rays, int mask, float4& tNear,
+                                   uint32_t index[4], Vector2f uv[4])
+    {
+        return object.intersectPacket(rays, mask, tNear, index, uv);
+    }
+
+    BVH bvh;
+    std::vector<PrimitiveRef> refs; // in leaf order
+    std::vector<SphereRecord> spheres;
+    std::vector<Object*> sphereObjects;
+    std::vector<MeshTriangle*> meshes;
+    std::vector<SphereGroup*> sphereGroups;
+    std::vector<MeshInstance*> instances;
+    std::vector<Object*> others;
+    // by primitive index, the order the objects were added in
+    std::vector<Object*> primObjects;
+    std::vector<Bounds3> primBounds;
+    std::vector<PrimitiveRef> refsByPrim; // spheres index sphereByPrim
+    std::vector<SphereRecord> sphereByPrim;
+    std::vector<uint32_t> slotOfPrim; // position in refs
+    std::unordered_map<const Object*, uint32_t> primOf;
+};
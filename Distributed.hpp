@@ -0,0 +1,577 @@
+#pragma once
+#include "FrameBuffer.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include "SceneCache.hpp"
+#include "Socket.hpp"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rendering one frame on several machines. A RenderCoordinator connects to
+// RenderWorkers over TCP, ships them the scene once as a scene cache (see
+// SceneCache.hpp, so workers must run the same build), and then hands out
+// work units of one block of the image and a range of its sample passes. The
+// workers send back the mean of those passes as floats, and the coordinator
+// composites them into the frame. The protocol is one command per line:
+//
+//   scene <bytes>                         a scene cache of that many bytes follows
+//   view <width> <height> <max-depth> <min-contribution> <epsilon>
+//        <light-samples> <background> <camera>   settings not in the cache
+//   tile <id> <i0> <i1> <j0> <j1> <first-pass> <passes>
+//   quit
+//
+// scene and view are answered with "ok", tile with "tile <id> <seconds> <bytes>"
+// and the block's pixels, top row first, as 3 floats each; any failure with
+// "error <message>". Every pixel gets the samples it would get from one
+// Renderer, so the image does not depend on how the frame was split up.
+namespace distributed_detail {
+
+// name of a new empty file in $TMPDIR, or /tmp
+inline std::string temp_file() {
+  const char *dir = std::getenv("TMPDIR");
+  std::string path = std::string(dir && *dir ? dir : "/tmp") + "/rtsceneXXXXXX";
+  const int fd = ::mkstemp(&path[0]);
+  if (fd < 0)
+    throw "distributed error:cannot create a temporary file";
+  ::close(fd);
+  return path;
+}
+
+inline std::ostream &put(std::ostream &out, const Vector3f &v) {
+  return out << ' ' << v.x << ' ' << v.y << ' ' << v.z;
+}
+
+// a whole integer token in [lo, hi]
+inline int get_int(std::istream &in, int lo, int hi) {
+  long long v;
+  if (!(in >> v) || v < lo || v > hi ||
+      !(in.peek() == EOF || std::isspace(in.peek())))
+    throw "distributed error:bad arguments";
+  return (int)v;
+}
+
+inline float get_float(std::istream &in) {
+  float v;
+  if (!(in >> v))
+    throw "distributed error:bad arguments";
+  return v;
+}
+
+inline Vector3f get_vector(std::istream &in) {
+  const float x = get_float(in), y = get_float(in);
+  return Vector3f(x, y, get_float(in));
+}
+
+inline std::string view_command(const Scene &scene) {
+  std::ostringstream out;
+  // enough digits for every float to read back unchanged
+  out << std::setprecision(9) << "view " << scene.width << ' ' << scene.height
+      << ' ' << scene.maxDepth << ' ' << scene.minContribution << ' '
+      << scene.epsilon << ' ' << scene.lightSamples;
+  put(out, scene.backgroundColor);
+  const Camera &c = scene.camera;
+  put(put(put(put(out, c.position), c.forward), c.up), c.right);
+  out << ' ' << c.fov << ' ' << c.aperture << ' ' << c.focusDistance << '\n';
+  return out.str();
+}
+
+// largest image width or height a view may ask for
+constexpr int kMaxImageSize = 16384;
+
+inline void read_view(std::istream &in, Scene &scene) {
+  const int width = get_int(in, 1, kMaxImageSize),
+            height = get_int(in, 1, kMaxImageSize);
+  const int max_depth = get_int(in, INT_MIN, INT_MAX);
+  const float min_contribution = get_float(in), epsilon = get_float(in);
+  const int light_samples = get_int(in, INT_MIN, INT_MAX);
+  scene.width = width;
+  scene.height = height;
+  scene.maxDepth = max_depth;
+  scene.minContribution = min_contribution;
+  scene.epsilon = epsilon;
+  scene.lightSamples = light_samples;
+  scene.backgroundColor = get_vector(in);
+  Camera &c = scene.camera;
+  c.position = get_vector(in);
+  c.forward = get_vector(in);
+  c.up = get_vector(in);
+  c.right = get_vector(in);
+  c.fov = get_float(in);
+  c.aperture = get_float(in);
+  c.focusDistance = get_float(in);
+}
+
+} // namespace distributed_detail
+
+// Renders tiles for one coordinator at a time, with every thread of its
+// Renderer.
+class RenderWorker {
+public:
+  // largest scene cache a coordinator may send
+  static constexpr uint64_t kMaxSceneBytes = uint64_t(4) << 30;
+
+  explicit RenderWorker(Renderer &renderer) : renderer(renderer) {}
+
+  // Serves the coordinators connecting to port one after another, forever. The
+  // protocol has no authentication, so only listen on the interfaces of host
+  // (an address or name, "0.0.0.0" or "::" for all) on a trusted network.
+  void Listen(int port, const std::string &host = "127.0.0.1") {
+    Listener listener(port, host);
+    for (;;) {
+      Socket socket = listener.accept();
+      try {
+        Serve(socket);
+      } catch (const char *) {
+        // the coordinator went away; wait for the next one
+      } catch (const std::exception &) {
+      }
+    }
+  }
+
+  // handles commands until quit or the end of the stream
+  void Serve(Socket &socket) {
+    std::string line;
+    while (socket.read_line(line)) {
+      if (line.empty())
+        continue;
+      try {
+        if (!Handle(line, socket))
+          return;
+      } catch (const char *message) {
+        socket.write(std::string("error ") + message + "\n");
+      } catch (const std::exception &e) {
+        socket.write(std::string("error distributed error:") + e.what() + "\n");
+      }
+    }
+  }
+
+private:
+  bool Handle(const std::string &line, Socket &socket) {
+    using namespace distributed_detail;
+    std::istringstream args(line);
+    std::string command;
+    args >> command;
+    if (command == "quit") {
+      socket.write("ok\n");
+      return false;
+    }
+    if (command == "scene") {
+      uint64_t bytes = 0;
+      if (!(args >> bytes) || bytes == 0)
+        throw "distributed error:bad arguments";
+      if (bytes > kMaxSceneBytes) {
+        // the payload cannot be skipped safely; drop the connection
+        socket.write("error distributed error:scene too large\n");
+        return false;
+      }
+      load_scene(socket, bytes);
+    } else if (command == "view") {
+      if (!scene)
+        throw "distributed error:no scene";
+      read_view(args, *scene);
+    } else if (command == "tile") {
+      if (!scene)
+        throw "distributed error:no scene";
+      render_tile(args, socket);
+      return true;
+    } else {
+      throw "distributed error:unknown command";
+    }
+    socket.write("ok\n");
+    return true;
+  }
+
+  // The cache is mapped in place, so the bytes following on socket go to a
+  // file in chunks; the mapping keeps the data once the file is unlinked. All of
+  // them are read even when the file cannot be written, keeping the stream in
+  // step.
+  void load_scene(Socket &socket, uint64_t bytes) {
+    const std::string path = distributed_detail::temp_file();
+    auto next = std::make_unique<Scene>(1, 1);
+    try {
+      {
+        std::ofstream out(path, std::ios::binary);
+        std::vector<char> chunk(std::min<uint64_t>(bytes, 1 << 20));
+        for (uint64_t left = bytes; left > 0;) {
+          const size_t n = std::min<uint64_t>(left, chunk.size());
+          socket.read(chunk.data(), n);
+          out.write(chunk.data(), n);
+          left -= n;
+        }
+        if (!out.flush())
+          throw "distributed error:cannot write the scene";
+      }
+      load_scene_cache(path, *next);
+    } catch (...) {
+      std::remove(path.c_str());
+      throw;
+    }
+    std::remove(path.c_str());
+    scene = std::move(next);
+    scene->compile();
+  }
+
+  void render_tile(std::istream &args, Socket &socket) {
+    using distributed_detail::get_int;
+    const int id = get_int(args, 0, INT_MAX);
+    const int i0 = get_int(args, 0, scene->height), i1 = get_int(args, 0, scene->height);
+    const int j0 = get_int(args, 0, scene->width), j1 = get_int(args, 0, scene->width);
+    const int first_pass = get_int(args, 0, INT_MAX);
+    const int passes = get_int(args, 1, INT_MAX - first_pass);
+    const auto start = std::chrono::steady_clock::now();
+    renderer.RenderRegion(*scene, i0, i1, j0, j1, first_pass, passes, tile);
+    pixels.clear();
+    for (int y = 0; y < tile.get_height(); ++y)
+      for (int x = 0; x < tile.get_width(); ++x) {
+        const Vector3f &c = tile.at(x, y);
+        pixels.insert(pixels.end(), {c.x, c.y, c.z});
+      }
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    std::ostringstream reply;
+    reply << "tile " << id << " " << seconds << " "
+          << pixels.size() * sizeof(float) << "\n";
+    socket.write(reply.str());
+    socket.write(pixels.data(), pixels.size() * sizeof(float));
+  }
+
+  Renderer &renderer;
+  std::unique_ptr<Scene> scene;
+  FrameBuffer tile;
+  std::vector<float> pixels;
+};
+
+struct DistributedSettings {
+  // edge of the square blocks handed out, a multiple of Renderer::kTileSize;
+  // a block should hold several Renderer tiles per worker thread
+  int tile_size = 128;
+  // the passes of a block are split into units of about this many seconds,
+  // going by the block's measured cost
+  double unit_seconds = 0.5;
+  // units queued on a worker beyond the one it renders, hiding the round trip
+  int prefetch = 1;
+};
+
+struct DistributedStats {
+  double seconds = 0;
+  size_t units = 0;
+  std::vector<size_t> units_per_worker; // by worker, 0 for the failed ones
+  size_t failed_workers = 0;
+};
+
+// Splits frames over the workers. Units are handed out costliest first, by the
+// seconds per pass each block took last time, so the long units start early
+// and the short ones fill in at the end; a block measured for the first time
+// renders one pass before the rest of its passes are planned. Workers pull
+// units as they finish, so faster nodes take more of them. Units of a worker
+// that fails go back to the others.
+class RenderCoordinator {
+public:
+  // connects to the workers, "host:port" each; unreachable ones are left out
+  explicit RenderCoordinator(const std::vector<std::string> &addresses,
+                             DistributedSettings settings = {})
+      : settings(settings) {
+    if (settings.tile_size <= 0 || settings.tile_size % Renderer::kTileSize)
+      throw "distributed error:tile size not a multiple of the renderer's";
+    for (const std::string &address : addresses) {
+      try {
+        workers.push_back(std::make_unique<Worker>(Socket::connect_to(address)));
+      } catch (const char *) {
+      }
+    }
+    if (workers.empty())
+      throw "distributed error:no worker reachable";
+  }
+
+  ~RenderCoordinator() {
+    for (auto &w : workers) {
+      try {
+        if (w->socket.is_open())
+          w->socket.write("quit\n");
+      } catch (const char *) {
+      }
+    }
+  }
+
+  [[nodiscard]] size_t get_num_workers() const { return live_workers(); }
+
+  // Sends the objects, lights and materials of scene to every worker; again
+  // whenever they change. The rest of the scene goes with every frame.
+  void SetScene(const Scene &scene) {
+    const std::string path = distributed_detail::temp_file();
+    std::vector<char> data;
+    try {
+      write_scene_cache(path, scene);
+      std::ifstream in(path, std::ios::binary);
+      data.assign(std::istreambuf_iterator<char>(in), {});
+    } catch (const char *) {
+      std::remove(path.c_str());
+      throw;
+    }
+    std::remove(path.c_str());
+    const std::string command = "scene " + std::to_string(data.size()) + "\n";
+    on_workers([&](Worker &w) {
+      w.socket.write(command);
+      w.socket.write(data.data(), data.size());
+      expect_ok(w);
+    });
+    tile_cost.clear();
+  }
+
+  // Renders samples passes per pixel of scene, as seen from its camera, into
+  // frame; the mean equals RenderBatch()'s with as many samples.
+  DistributedStats Render(const Scene &scene, int samples, FrameBuffer &frame) {
+    const auto start = std::chrono::steady_clock::now();
+    samples = std::max(samples, 1);
+    frame.resize(scene.width, scene.height);
+    plan_blocks(scene);
+    total_passes = samples;
+    done_blocks = 0;
+    units_sent = 0;
+    pending = {};
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+      blocks[b].next_pass = 0;
+      blocks[b].passes_done = 0;
+      plan_units(b);
+    }
+
+    const std::string view = distributed_detail::view_command(scene);
+    for (auto &w : workers)
+      w->units = 0;
+    on_workers([&](Worker &w) {
+      w.socket.write(view);
+      expect_ok(w);
+      run(w, frame);
+    });
+    if (done_blocks < blocks.size())
+      throw "distributed error:every worker failed";
+
+    DistributedStats stats;
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    stats.units = units_sent;
+    for (auto &w : workers) {
+      stats.units_per_worker.push_back(w->units);
+      stats.failed_workers += !w->socket.is_open();
+    }
+    return stats;
+  }
+
+private:
+  struct Worker {
+    explicit Worker(Socket socket) : socket(std::move(socket)) {}
+    Socket socket;
+    size_t units = 0;
+  };
+
+  // rows [i0, i1) counted from the bottom and columns [j0, j1), as Renderer
+  struct Block {
+    int i0, i1, j0, j1;
+    int next_pass = 0;   // first pass not yet handed out
+    int passes_done = 0; // composited
+  };
+
+  struct Unit {
+    uint32_t block;
+    int first_pass, passes;
+    double cost; // estimated seconds
+    bool operator<(const Unit &other) const { return cost < other.cost; }
+  };
+
+  size_t live_workers() const {
+    size_t n = 0;
+    for (auto &w : workers)
+      n += w->socket.is_open();
+    return n;
+  }
+
+  // f(worker) on a thread per live worker; a worker that throws is closed
+  template <typename F> void on_workers(F &&f) {
+    std::vector<std::thread> threads;
+    for (auto &w : workers) {
+      if (!w->socket.is_open())
+        continue;
+      Worker *worker = w.get();
+      threads.emplace_back([&f, worker] {
+        try {
+          f(*worker);
+        } catch (const char *) {
+          worker->socket.close();
+        }
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    if (live_workers() == 0)
+      throw "distributed error:every worker failed";
+  }
+
+  static void expect_ok(Worker &w) {
+    std::string line;
+    if (!w.socket.read_line(line) || line != "ok")
+      throw "distributed error:worker failed";
+  }
+
+  // the blocks and their costs carry over while the image size stays
+  void plan_blocks(const Scene &scene) {
+    const int size = settings.tile_size;
+    if (scene.width == planned_width && scene.height == planned_height)
+      return;
+    planned_width = scene.width;
+    planned_height = scene.height;
+    blocks.clear();
+    for (int i0 = 0; i0 < scene.height; i0 += size)
+      for (int j0 = 0; j0 < scene.width; j0 += size)
+        blocks.push_back({i0, std::min(i0 + size, scene.height), j0,
+                          std::min(j0 + size, scene.width)});
+    tile_cost.clear();
+  }
+
+  // queues the passes of block not handed out yet: one pass to measure a block
+  // without a cost, all of them in units of about unit_seconds otherwise
+  void plan_units(uint32_t b) {
+    Block &block = blocks[b];
+    const int remaining = total_passes - block.next_pass;
+    if (remaining <= 0)
+      return;
+    if (tile_cost.size() != blocks.size())
+      tile_cost.assign(blocks.size(), 0);
+    const double cost = tile_cost[b];
+    if (cost <= 0) {
+      // unmeasured blocks go before everything else
+      pending.push({b, block.next_pass++, 1, kInfinity});
+      return;
+    }
+    const int per_unit = std::clamp((int)(settings.unit_seconds / cost), 1, remaining);
+    const int units = (remaining + per_unit - 1) / per_unit;
+    for (int u = 0; u < units; ++u) {
+      const int passes = remaining * (u + 1) / units - remaining * u / units;
+      pending.push({b, block.next_pass, passes, passes * cost});
+      block.next_pass += passes;
+    }
+  }
+
+  std::string tile_command(const Unit &unit) const {
+    const Block &b = blocks[unit.block];
+    std::ostringstream out;
+    out << "tile " << unit.block << ' ' << b.i0 << ' ' << b.i1 << ' ' << b.j0
+        << ' ' << b.j1 << ' ' << unit.first_pass << ' ' << unit.passes << '\n';
+    return out.str();
+  }
+
+  // the unit loop of one worker: keeps 1 + prefetch units on it, composites the
+  // results in the order they were asked for
+  void run(Worker &w, FrameBuffer &frame) {
+    const size_t queue_depth = 1 + std::max(settings.prefetch, 0);
+    std::deque<Unit> sent; // written to the worker, not yet received
+    std::vector<float> pixels;
+    try {
+      for (;;) {
+        size_t fresh = 0;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if (sent.empty())
+            ready.wait(lock, [&] {
+              return !pending.empty() || done_blocks == blocks.size();
+            });
+          for (; !pending.empty() && sent.size() < queue_depth; ++fresh) {
+            sent.push_back(pending.top());
+            pending.pop();
+            ++units_sent;
+          }
+          if (sent.empty())
+            return;
+        }
+        for (size_t k = sent.size() - fresh; k < sent.size(); ++k)
+          w.socket.write(tile_command(sent[k]));
+        receive(w, sent.front(), pixels, frame);
+        sent.pop_front();
+        ++w.units;
+      }
+    } catch (const char *) {
+      // hand the units back to the other workers
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const Unit &unit : sent)
+        pending.push(unit);
+      units_sent -= sent.size();
+      w.socket.close();
+      ready.notify_all();
+      throw;
+    }
+  }
+
+  void receive(Worker &w, const Unit &unit, std::vector<float> &pixels,
+               FrameBuffer &frame) {
+    std::string line;
+    if (!w.socket.read_line(line))
+      throw "distributed error:worker failed";
+    std::istringstream reply(line);
+    std::string word;
+    long id = -1;
+    double seconds = 0;
+    uint64_t bytes = 0;
+    reply >> word >> id >> seconds >> bytes;
+    const Block &b = blocks[unit.block];
+    const int width = b.j1 - b.j0, height = b.i1 - b.i0;
+    if (word != "tile" || id != (long)unit.block ||
+        bytes != (uint64_t)width * height * 3 * sizeof(float))
+      throw "distributed error:worker failed";
+    pixels.resize(bytes / sizeof(float));
+    w.socket.read(pixels.data(), bytes);
+
+    // a unit holding every pass is copied as is, so whole blocks match
+    // the single machine image bit for bit
+    const float weight = (float)unit.passes / total_passes;
+    const int y0 = planned_height - b.i1;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x) {
+        const float *p = &pixels[((size_t)y * width + x) * 3];
+        Vector3f &out = frame.at(b.j0 + x, y0 + y);
+        if (unit.passes == total_passes)
+          out = Vector3f(p[0], p[1], p[2]);
+        else
+          out += Vector3f(p[0], p[1], p[2]) * weight;
+      }
+    tile_cost[unit.block] = seconds / unit.passes;
+    Block &block = blocks[unit.block];
+    block.passes_done += unit.passes;
+    if (unit.first_pass == 0 && unit.passes == 1 && block.next_pass == 1)
+      plan_units(unit.block);
+    if (block.passes_done == total_passes)
+      ++done_blocks;
+    ready.notify_all();
+  }
+
+  DistributedSettings settings;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<Block> blocks;
+  std::vector<double> tile_cost; // seconds per pass, by block; 0 unmeasured
+  int planned_width = 0, planned_height = 0;
+  // of the frame being rendered, under mutex
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::priority_queue<Unit> pending;
+  int total_passes = 1;
+  size_t done_blocks = 0;
+  size_t units_sent = 0;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Vector.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+enum class PixelLayout
+{
+    // rows one after another, each row padded to a multiple of kCacheLine bytes
+    Linear,
+    // 8x8 pixel blocks stored row-major, pixels inside a block in Morton order
+    Tiled
+};
+
+// 2D pixel storage in a single cache-line aligned allocation. Pixel (0, 0) is the
+// top-left corner of the image. The allocation is kept across resize() calls that
+// do not grow it, so a renderer can reuse one buffer for every frame.
+template <typename T>
+class PixelBuffer
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                  "PixelBuffer stores plain pixel values");
+
+public:
+    static constexpr size_t kCacheLine = 64;
+    static constexpr int kBlockSize = 8;
+
+    PixelBuffer() = default;
+    PixelBuffer(int w, int h, PixelLayout l = PixelLayout::Linear) { resize(w, h, l); }
+
+    void resize(int w, int h, PixelLayout l = PixelLayout::Linear)
+    {
+        width = w;
+        height = h;
+        pixelLayout = l;
+        if (l == PixelLayout::Linear)
+        {
+            // keep every row start on a cache line boundary
+            rowStride = w;
+            while (rowStride * sizeof(T) % kCacheLine != 0)
+                ++rowStride;
+            pixelCount = rowStride * h;
+        }
+        else
+        {
+            blocksPerRow = (w + kBlockSize - 1) / kBlockSize;
+            rowStride = w;
+            pixelCount = (size_t)blocksPerRow * ((h + kBlockSize - 1) / kBlockSize) * kBlockSize * kBlockSize;
+        }
+        if (pixelCount > capacity)
+        {
+            storage.reset(static_cast<T*>(::operator new(pixelCount * sizeof(T), std::align_val_t(kCacheLine))));
+            capacity = pixelCount;
+        }
+        clear();
+    }
+
+    void clear() { std::fill(storage.get(), storage.get() + pixelCount, T()); }
+
+    T& at(int x, int y) { return storage[index(x, y)]; }
+    const T& at(int x, int y) const { return storage[index(x, y)]; }
+
+    size_t index(int x, int y) const
+    {
+        if (pixelLayout == PixelLayout::Linear)
+            return (size_t)y * rowStride + x;
+        size_t block = (size_t)(y / kBlockSize) * blocksPerRow + x / kBlockSize;
+        return block * kBlockSize * kBlockSize + morton(x % kBlockSize, y % kBlockSize);
+    }
+
+    [[nodiscard]] int get_width() const { return width; }
+    [[nodiscard]] int get_height() const { return height; }
+    [[nodiscard]] PixelLayout layout() const { return pixelLayout; }
+    // distance in pixels between the starts of two rows (Linear layout)
+    [[nodiscard]] size_t stride() const { return rowStride; }
+
+    // raw storage, including row or block padding, for zero-copy consumers
+    T* data() { return storage.get(); }
+    const T* data() const { return storage.get(); }
+    [[nodiscard]] size_t size() const { return pixelCount; }
+    [[nodiscard]] size_t size_bytes() const { return pixelCount * sizeof(T); }
+
+    // contiguous run of width pixels, only meaningful for the Linear layout
+    T* row(int y) { return storage.get() + (size_t)y * rowStride; }
+    const T* row(int y) const { return storage.get() + (size_t)y * rowStride; }
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(T* p) const { ::operator delete(p, std::align_val_t(kCacheLine)); }
+    };
+
+    // interleave the 3 low bits of x and y
+    static uint32_t morton(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint32_t v) {
+            v = (v | (v << 2)) & 0x33;
+            return (v | (v << 1)) & 0x55;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    std::unique_ptr<T[], AlignedDelete> storage;
+    size_t capacity = 0;
+    size_t pixelCount = 0;
+    size_t rowStride = 0;
+    int blocksPerRow = 0;
+    int width = 0, height = 0;
+    PixelLayout pixelLayout = PixelLayout::Linear;
+};
+
+using FrameBuffer = PixelBuffer<Vector3f>;
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "FrameBuffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum class ImageFormat { PPM, PFM, PNG };
+
+// picks the format from the file extension, PPM when there is none we know
+inline ImageFormat image_format_from_path(const std::string &path) {
+  auto ends_with = [&](const char *ext) {
+    size_t n = strlen(ext);
+    return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+  };
+  if (ends_with(".pfm"))
+    return ImageFormat::PFM;
+  if (ends_with(".png"))
+    return ImageFormat::PNG;
+  return ImageFormat::PPM;
+}
+
+// Clamps to [0, 1] and packs the frame into top-down RGB8, 3 bytes per pixel.
+// The inner loop is branch free so it vectorizes.
+inline void quantize_rgb8(const FrameBuffer &frame, uint8_t *out) {
+  const int w = frame.get_width();
+  for (int y = 0; y < frame.get_height(); ++y) {
+    uint8_t *dst = out + (size_t)y * w * 3;
+    if (frame.layout() == PixelLayout::Linear) {
+      const Vector3f *src = frame.row(y);
+      for (int x = 0; x < w; ++x) {
+        dst[3 * x] = (uint8_t)(255 * std::min(1.f, std::max(0.f, src[x].x)));
+        dst[3 * x + 1] = (uint8_t)(255 * std::min(1.f, std::max(0.f, src[x].y)));
+        dst[3 * x + 2] = (uint8_t)(255 * std::min(1.f, std::max(0.f, src[x].z)));
+      }
+    } else {
+      for (int x = 0; x < w; ++x) {
+        const Vector3f &p = frame.at(x, y);
+        dst[3 * x] = (uint8_t)(255 * std::min(1.f, std::max(0.f, p.x)));
+        dst[3 * x + 1] = (uint8_t)(255 * std::min(1.f, std::max(0.f, p.y)));
+        dst[3 * x + 2] = (uint8_t)(255 * std::min(1.f, std::max(0.f, p.z)));
+      }
+    }
+  }
+}
+
+namespace image_detail {
+
+inline uint32_t crc32(const uint8_t *data, size_t n, uint32_t crc = 0) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+inline void put_be32(std::vector<uint8_t> &out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+inline void put_chunk(std::vector<uint8_t> &out, const char *type,
+                      const uint8_t *data, size_t n) {
+  put_be32(out, n);
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + n);
+  put_be32(out, crc32(&out[start], out.size() - start));
+}
+
+inline void write_file(const std::string &path, const std::vector<uint8_t> &bytes) {
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    throw "write image error:file cannot open";
+  }
+  size_t written = std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::fclose(file);
+  if (written != bytes.size()) {
+    throw "write image error:short write";
+  }
+}
+
+} // namespace image_detail
+
+// Binary PPM file contents, header and quantized pixels in one buffer.
+inline std::vector<uint8_t> encode_ppm(const FrameBuffer &frame) {
+  const std::string header = "P6\n" + std::to_string(frame.get_width()) + " " +
+                             std::to_string(frame.get_height()) + "\n255\n";
+  std::vector<uint8_t> bytes(header.size() + (size_t)frame.get_width() * frame.get_height() * 3);
+  memcpy(bytes.data(), header.data(), header.size());
+  quantize_rgb8(frame, bytes.data() + header.size());
+  return bytes;
+}
+
+// Binary PPM in a single write.
+inline void write_ppm(const std::string &path, const FrameBuffer &frame) {
+  image_detail::write_file(path, encode_ppm(frame));
+}
+
+// Little-endian PFM keeps the unclamped float radiance. PFM stores the bottom
+// row first.
+inline void write_pfm(const std::string &path, const FrameBuffer &frame) {
+  const int w = frame.get_width(), h = frame.get_height();
+  const std::string header =
+      "PF\n" + std::to_string(w) + " " + std::to_string(h) + "\n-1.0\n";
+  std::vector<float> pixels((size_t)w * h * 3);
+  float *dst = pixels.data();
+  for (int y = h - 1; y >= 0; --y) {
+    for (int x = 0; x < w; ++x) {
+      const Vector3f &p = frame.at(x, y);
+      *dst++ = p.x;
+      *dst++ = p.y;
+      *dst++ = p.z;
+    }
+  }
+  std::vector<uint8_t> bytes(header.size() + pixels.size() * sizeof(float));
+  memcpy(bytes.data(), header.data(), header.size());
+  memcpy(bytes.data() + header.size(), pixels.data(), pixels.size() * sizeof(float));
+  image_detail::write_file(path, bytes);
+}
+
+// 8-bit RGB PNG. The zlib stream uses stored (uncompressed) deflate blocks, so
+// no compression library is needed and encoding stays a straight copy.
+inline void write_png(const std::string &path, const FrameBuffer &frame) {
+  using namespace image_detail;
+  const int w = frame.get_width(), h = frame.get_height();
+  const size_t row_bytes = (size_t)w * 3;
+
+  std::vector<uint8_t> pixels(row_bytes * h);
+  quantize_rgb8(frame, pixels.data());
+  // every scanline is prefixed with filter type 0 (none)
+  std::vector<uint8_t> raw((row_bytes + 1) * h);
+  for (int y = 0; y < h; ++y) {
+    raw[y * (row_bytes + 1)] = 0;
+    memcpy(&raw[y * (row_bytes + 1) + 1], &pixels[y * row_bytes], row_bytes);
+  }
+
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  uint32_t a = 1, b = 0;
+  for (size_t pos = 0;;) {
+    const size_t n = std::min<size_t>(65535, raw.size() - pos);
+    const bool last = pos + n == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(n & 0xFF);
+    zlib.push_back(n >> 8);
+    zlib.push_back(~n & 0xFF);
+    zlib.push_back((~n >> 8) & 0xFF);
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + n);
+    for (size_t i = pos; i < pos + n; ++i) {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    pos += n;
+    if (last)
+      break;
+  }
+  put_be32(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> bytes = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  bytes.reserve(zlib.size() + 64);
+  uint8_t ihdr[13] = {0};
+  for (int i = 0; i < 4; ++i) {
+    ihdr[i] = (uint32_t)w >> (24 - 8 * i);
+    ihdr[4 + i] = (uint32_t)h >> (24 - 8 * i);
+  }
+  ihdr[8] = 8; // bit depth
+  ihdr[9] = 2; // color type RGB
+  put_chunk(bytes, "IHDR", ihdr, sizeof(ihdr));
+  put_chunk(bytes, "IDAT", zlib.data(), zlib.size());
+  put_chunk(bytes, "IEND", nullptr, 0);
+  write_file(path, bytes);
+}
+
+inline void write_image(const std::string &path, const FrameBuffer &frame,
+                        ImageFormat format) {
+  switch (format) {
+  case ImageFormat::PFM:
+    write_pfm(path, frame);
+    break;
+  case ImageFormat::PNG:
+    write_png(path, frame);
+    break;
+  default:
+    write_ppm(path, frame);
+    break;
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Object.hpp"
+#include "Transform.hpp"
+#include "Triangle.hpp"
+
+#include <memory>
+
+// A placed copy of a shared mesh. Rays are moved into the mesh's object space
+// and traced against its bottom-level BVH there, so every instance costs a
+// transform instead of a copy of the geometry. The direction is not
+// renormalized, which keeps t the same in both spaces. The instance has its
+// own materialId; the mesh's is ignored.
+class MeshInstance final : public Object
+{
+public:
+    MeshInstance(std::shared_ptr<const MeshTriangle> m, const Transform& toWorld)
+        : mesh(std::move(m))
+        , objectToWorld(toWorld)
+        , worldToObject(toWorld.Inverse())
+    {}
+
+    bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t& index,
+                   Vector2f& uv) const override
+    {
+        return mesh->intersect(worldToObject.Point(orig), worldToObject.Vector(dir), tnear, index, uv);
+    }
+
+    bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const override
+    {
+        return mesh->occluded(worldToObject.Point(orig), worldToObject.Vector(dir), tMax);
+    }
+
+    int intersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, uint32_t index[4],
+                        Vector2f uv[4]) const override
+    {
+        RayPacket4 local(worldToObject.Point(rays.o), worldToObject.Vector(rays.d));
+        return mesh->intersectPacket(local, activeMask, tNear, index, uv);
+    }
+
+    void getSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index, const Vector2f& uv,
+                              Vector3f& N, Vector2f& st) const override
+    {
+        mesh->getSurfaceProperties(worldToObject.Point(P), worldToObject.Vector(I), index, uv, N, st);
+        N = normalize(objectToWorld.Normal(N));
+    }
+
+    Bounds3 getBounds() const override
+    {
+        return objectToWorld(mesh->getBounds());
+    }
+
+    Vector3f evalDiffuseColor(const Material& material, const Vector2f& st) const override
+    {
+        return mesh->evalDiffuseColor(material, st);
+    }
+
+    // Moves the instance; Scene::MarkChanged() and Update() then refit the scene
+    // BVH to it.
+    void SetTransform(const Transform& toWorld)
+    {
+        objectToWorld = toWorld;
+        worldToObject = toWorld.Inverse();
+    }
+
+    [[nodiscard]] const std::shared_ptr<const MeshTriangle>& get_mesh() const { return mesh; }
+    [[nodiscard]] const Transform& get_transform() const { return objectToWorld; }
+
+private:
+    std::shared_ptr<const MeshTriangle> mesh;
+    Transform objectToWorld;
+    Transform worldToObject;
+};
@@ -0,0 +1,315 @@
+#pragma once
+#include "RayPacket.hpp"
+#include "Scene.hpp"
+#include "Stats.hpp"
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Closest hit of a ray. Fixed size and trivially copyable: trace() and the
+// traversal write it in place, and the wavefront queues keep arrays of them.
+struct hit_payload {
+  float tNear;
+  uint32_t index;
+  Vector2f uv;
+  Object *hit_obj;
+};
+static_assert(sizeof(hit_payload) <= 32 && std::is_trivially_copyable<hit_payload>::value,
+              "hit records stay compact");
+
+inline float deg2rad(const float &deg) { return deg * M_PI / 180.0; }
+
+inline Vector3f reflect(const Vector3f &I, const Vector3f &N) {
+  return I - 2 * dotProduct(I, N) * N;
+}
+
+inline Vector3f refract(const Vector3f &I, const Vector3f &N,
+                        const float &ior) {
+  float cosi = fabs(clamp(-1, 1, dotProduct(I, N)));
+  auto t=1 - 1/ior * 1/ior * (1 - cosi * cosi);
+  if(t<0) return 0;
+  float coso =sqrtf(t);
+  return 1/ior * I + (1/ior * cosi - coso) * N;
+}
+
+// Schlick's approximation, from the reflectance r0 at normal incidence
+inline float fresnel_schlick(const Vector3f &I, const Vector3f &N, float r0) {
+  const float m = 1 - fabs(clamp(-1, 1, dotProduct(I, N)));
+  const float m2 = m * m;
+  return r0 + (1 - r0) * (m2 * m2 * m);
+}
+
+inline float fresnel(const Vector3f &I, const Vector3f &N, const float &ior) {
+  return fresnel_schlick(I, N, fresnel_r0(ior));
+}
+
+// Closest hit along the ray into hit, written in place; false, with hit
+// undefined, when the ray hits nothing.
+inline bool trace(const Vector3f &orig, const Vector3f &dir, const Scene &scene,
+                  hit_payload &hit) {
+  hit.tNear = kInfinity;
+  if (const CompiledScene *compiled = scene.get_compiled(); compiled)
+    return compiled->Intersect(orig, dir, hit.tNear, hit.index, hit.uv,
+                               hit.hit_obj);
+  bool found = false;
+  for (const auto &object : scene.get_objects()) {
+    float tNearK = kInfinity;
+    uint32_t indexK;
+    Vector2f uvK;
+    if (object->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < hit.tNear) {
+      hit = {tNearK, indexK, uvK, object.get()};
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Any-hit query for shadow rays: whether something lies on the segment from orig
+// to orig + tMax * dir.
+inline bool occluded(const Vector3f &orig, const Vector3f &dir, float tMax,
+                     const Scene &scene) {
+  RT_STAT(ShadowRays);
+  if (const CompiledScene *compiled = scene.get_compiled(); compiled)
+    return compiled->Occluded(orig, dir, tMax);
+  for (const auto &object : scene.get_objects()) {
+    if (object->occluded(orig, dir, tMax))
+      return true;
+  }
+  return false;
+}
+
+// Packet version of trace() for coherent primary rays. Fills payload[i] for every
+// lane i of activeMask that hit something and returns the mask of those lanes.
+inline int tracePacket(const RayPacket4 &rays, int activeMask,
+                       const Scene &scene, hit_payload payload[4]) {
+  int hits = 0;
+  if (const CompiledScene *compiled = scene.get_compiled(); compiled) {
+    float4 tNear(kInfinity);
+    uint32_t index[4];
+    Vector2f uv[4];
+    Object *hit_obj[4];
+    hits = compiled->IntersectPacket(rays, activeMask, tNear, index, uv, hit_obj);
+    for (int i = 0; i < RayPacket4::kSize; ++i) {
+      if (hits & (1 << i))
+        payload[i] = {tNear[i], index[i], uv[i], hit_obj[i]};
+    }
+    return hits;
+  }
+  for (int i = 0; i < RayPacket4::kSize; ++i) {
+    if (activeMask & (1 << i)) {
+      if (trace(rays.o.lane(i), rays.d.lane(i), scene, payload[i]))
+        hits |= 1 << i;
+    }
+  }
+  return hits;
+}
+
+// Ray spawned by a hit, weighted relative to the ray that produced it.
+struct SecondaryRay {
+  Vector3f orig;
+  Vector3f dir;
+  float weight;
+  bool refraction;
+};
+
+// Calls f with std::integral_constant<MaterialType, type>, which makes the type
+// a compile time constant in f; the switch runs once per call.
+template <typename F> decltype(auto) with_material_type(MaterialType type, F &&f) {
+  switch (type) {
+  case REFLECTION_AND_REFRACTION:
+    return f(std::integral_constant<MaterialType, REFLECTION_AND_REFRACTION>());
+  case REFLECTION:
+    return f(std::integral_constant<MaterialType, REFLECTION>());
+  default:
+    return f(std::integral_constant<MaterialType, DIFFUSE_AND_GLOSSY>());
+  }
+}
+
+// Light counts that get a diffuse kernel with the light loop unrolled; 0 is any
+// count.
+template <typename F> decltype(auto) with_light_count(size_t count, F &&f) {
+  switch (count) {
+  case 1:
+    return f(std::integral_constant<size_t, 1>());
+  case 2:
+    return f(std::integral_constant<size_t, 2>());
+  default:
+    return f(std::integral_constant<size_t, 0>());
+  }
+}
+
+// Shading kernel of one MaterialType and light count class (see shade()); the
+// hit must be on a material of type Type.
+template <MaterialType Type, size_t NumLights = 0>
+inline Vector3f shade_kernel(const Vector3f &orig, const Vector3f &dir,
+                             const hit_payload &payload, const Scene &scene,
+                             SecondaryRay secondary[2], int &numSecondary) {
+  numSecondary = 0;
+  Vector3f hitPoint = orig + dir * payload.tNear;
+  Vector3f N;  // normal
+  Vector2f st; // st coordinates
+  payload.hit_obj->getSurfaceProperties(hitPoint, dir, payload.index,
+                                        payload.uv, N, st);
+  const MaterialId id = payload.hit_obj->materialId;
+  const Material &material = scene.get_material(id);
+  if constexpr (Type == REFLECTION_AND_REFRACTION) {
+    Vector3f reflectionDirection = normalize(reflect(dir, N));
+    Vector3f refractionDirection =
+        normalize(refract(dir, N, material.ior));
+    Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0)
+                                     ? hitPoint - N * scene.epsilon
+                                     : hitPoint + N * scene.epsilon;
+    Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0)
+                                     ? hitPoint - N * scene.epsilon
+                                     : hitPoint + N * scene.epsilon;
+    float kr = fresnel_schlick(dir, N, scene.get_material_factors(id).fresnelR0);
+    secondary[numSecondary++] = {reflectionRayOrig, reflectionDirection, kr, false};
+    secondary[numSecondary++] = {refractionRayOrig, refractionDirection, 1 - kr, true};
+    return Vector3f();
+  } else if constexpr (Type == REFLECTION) {
+    float kr = fresnel_schlick(dir, N, scene.get_material_factors(id).fresnelR0);
+    Vector3f reflectionDirection = reflect(dir, N);
+    Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0)
+                                     ? hitPoint + N * scene.epsilon
+                                     : hitPoint - N * scene.epsilon;
+    secondary[numSecondary++] = {reflectionRayOrig, reflectionDirection, kr, false};
+    return Vector3f();
+  } else {
+    const auto &lights = scene.get_lights();
+    const float specularExponent = material.specularExponent;
+    Vector3f lightAmt = 0, specularColor = 0;
+    Vector3f shadowPointOrig = (dotProduct(dir, N) < 0)
+                                   ? hitPoint + N * scene.epsilon
+                                   : hitPoint - N * scene.epsilon;
+    auto addLight = [&](const Light &light, float weight) {
+      Vector3f lightDir = light.position - hitPoint;
+      float lightDistance2 = dotProduct(lightDir, lightDir);
+      if (lightDistance2 > light.radius * light.radius)
+        return;
+      lightDir = normalize(lightDir);
+      float LdotN = std::max(0.f, dotProduct(lightDir, N));
+      bool inShadow = occluded(shadowPointOrig, lightDir,
+                               std::sqrt(lightDistance2), scene);
+      const Vector3f intensity = weight * light.intensity;
+
+      lightAmt += inShadow ? 0 : intensity * LdotN;
+      Vector3f reflectionDirection = reflect(-lightDir, N);
+
+      specularColor +=
+          powf(std::max(0.f, -dotProduct(reflectionDirection, dir)),
+               specularExponent) *
+          intensity;
+    };
+
+    const LightTree *tree = NumLights ? nullptr : scene.get_light_tree();
+    if (!tree) {
+      const size_t numLights = NumLights ? NumLights : lights.size();
+      for (size_t l = 0; l < numLights; ++l)
+        addLight(*lights[l], 1.f);
+    } else if (scene.lightSamples <= 0) {
+      tree->ForEachLight(hitPoint,
+                         [&](uint32_t l) { addLight(*lights[l], 1.f); });
+    } else {
+      // the sample offset is hashed from the hit, so it is the same on any thread
+      uint32_t bits[3];
+      std::memcpy(bits, &hitPoint.x, sizeof(float));
+      std::memcpy(bits + 1, &hitPoint.y, sizeof(float));
+      std::memcpy(bits + 2, &hitPoint.z, sizeof(float));
+      const float u = hash_float(bits[0] ^ hash_u32(bits[1] ^ hash_u32(bits[2])));
+      tree->SampleLights(hitPoint, scene.lightSamples, u,
+                         [&](uint32_t l, float weight) {
+                           addLight(*lights[l], weight);
+                         });
+    }
+
+    return lightAmt * payload.hit_obj->evalDiffuseColor(material, st) *
+               material.Kd +
+           specularColor * material.Ks;
+  }
+}
+
+// Shades the hit of the ray from orig along dir. Returns the color computed
+// locally at the hit and appends the reflection/refraction rays whose colors
+// still have to be added on top (at most two) to secondary. Picks the kernel
+// per hit; batches of hits on one MaterialType can pick it once instead.
+inline Vector3f shade(const Vector3f &orig, const Vector3f &dir,
+                      const hit_payload &payload, const Scene &scene,
+                      SecondaryRay secondary[2], int &numSecondary) {
+  const MaterialType type =
+      scene.get_material(payload.hit_obj->materialId).materialType;
+  return with_material_type(type, [&](auto t) {
+    constexpr MaterialType kType = decltype(t)::value;
+    if constexpr (kType != DIFFUSE_AND_GLOSSY)
+      return shade_kernel<kType>(orig, dir, payload, scene, secondary,
+                                 numSecondary);
+    else
+      return with_light_count(scene.get_lights().size(), [&](auto n) {
+        return shade_kernel<kType, decltype(n)::value>(
+            orig, dir, payload, scene, secondary, numSecondary);
+      });
+  });
+}
+
+// Rays queued by castRay(); beyond this many pending rays further ones are culled.
+constexpr int kMaxRayStack = 64;
+
+// Iterative Whitted integrator. The ray tree is walked depth first on a fixed
+// size stack: every entry carries the product of the Fresnel weights along its
+// path, and branches whose weight falls below scene.minContribution are culled
+// instead of traced. hit is the already known result of trace(orig, dir),
+// nullptr for a miss.
+inline Vector3f integrate(const Vector3f &orig, const Vector3f &dir,
+                          const hit_payload *hit, const Scene &scene,
+                          int depth) {
+  struct PendingRay {
+    Vector3f orig;
+    Vector3f dir;
+    float weight;
+    int depth;
+  };
+  PendingRay stack[kMaxRayStack];
+  int size = 0;
+
+  Vector3f color;
+  hit_payload payload;
+  bool found = hit != nullptr;
+  if (hit)
+    payload = *hit;
+  PendingRay ray = {orig, dir, 1.f, depth};
+  while (true) {
+    if (found) {
+      SecondaryRay secondary[2];
+      int numSecondary;
+      color += ray.weight * shade(ray.orig, ray.dir, payload, scene,
+                                  secondary, numSecondary);
+      // rays past maxDepth contribute black, so they are never queued
+      for (int k = numSecondary - 1; k >= 0; --k) {
+        const float weight = ray.weight * secondary[k].weight;
+        if (ray.depth + 1 > scene.maxDepth || weight < scene.minContribution ||
+            size == kMaxRayStack)
+          continue;
+        RT_STAT_ADD(RefractionRays, secondary[k].refraction);
+        RT_STAT_ADD(ReflectionRays, !secondary[k].refraction);
+        stack[size++] = {secondary[k].orig, secondary[k].dir, weight,
+                         ray.depth + 1};
+      }
+    } else {
+      color += ray.weight * scene.backgroundColor;
+    }
+    if (size == 0)
+      break;
+    ray = stack[--size];
+    found = trace(ray.orig, ray.dir, scene, payload);
+  }
+  return color;
+}
+
+inline Vector3f castRay(const Vector3f &orig, const Vector3f &dir,
+                        const Scene &scene, int depth) {
+  if (depth > scene.maxDepth) {
+    return Vector3f(0.0, 0.0, 0.0);
+  }
+  hit_payload hit;
+  const bool found = trace(orig, dir, scene, hit);
+  return integrate(orig, dir, found ? &hit : nullptr, scene, depth);
+}
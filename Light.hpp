@@ -1,15 +1,21 @@
 #pragma once
 
 #include "Vector.hpp"
+#include "global.hpp"
 
+// Point light. A light with a finite radius has no effect on points farther
+// away than that, which lets shading skip it (see LightTree); the default
+// lights the whole scene.
 class Light
 {
 public:
-    Light(const Vector3f& p, const Vector3f& i)
+    Light(const Vector3f& p, const Vector3f& i, float r = kInfinity)
         : position(p)
         , intensity(i)
+        , radius(r)
     {}
     virtual ~Light() = default;
     Vector3f position;
     Vector3f intensity;
+    float radius;
 };
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "BVH.hpp"
+#include "Light.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Render-time index of the lights of a Scene. Lights of finite radius sit in a
+// BVH over the boxes of their spheres of influence, so a shading point only
+// visits the lights that reach it; lights without a radius reach every point
+// and are kept in a list. Both orders are fixed, which keeps shading
+// deterministic.
+class LightTree
+{
+public:
+    explicit LightTree(const std::vector<std::unique_ptr<Light> >& lights)
+    {
+        std::vector<uint32_t> boundedByLight;
+        std::vector<Bounds3> influence;
+        importance.reserve(lights.size());
+        for (uint32_t l = 0; l < lights.size(); ++l)
+        {
+            const Light& light = *lights[l];
+            // the shading of a point scales with the intensity alone, there is no falloff
+            importance.push_back(std::max(0.f, light.intensity.x + light.intensity.y + light.intensity.z));
+            if (light.radius >= kInfinity)
+            {
+                unbounded.push_back(l);
+                continue;
+            }
+            boundedByLight.push_back(l);
+            influence.emplace_back(light.position - Vector3f(light.radius), light.position + Vector3f(light.radius));
+        }
+        bvh = BVH(influence, 2);
+
+        // store the bounded lights in leaf order
+        for (uint32_t prim : bvh.get_prim_indices())
+        {
+            const Light& light = *lights[boundedByLight[prim]];
+            bounded.push_back({light.position, light.radius * light.radius, boundedByLight[prim]});
+        }
+    }
+
+    size_t get_num_bounded() const { return bounded.size(); }
+    size_t get_num_unbounded() const { return unbounded.size(); }
+
+    // calls visit(lightIndex) for every light reaching p: the unbounded ones in
+    // scene order, then the bounded ones whose sphere of influence contains p
+    template <typename Visit>
+    void ForEachLight(const Vector3f& p, Visit&& visit) const
+    {
+        for (uint32_t l : unbounded)
+            visit(l);
+        bvh.VisitLeavesContaining(p, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const Vector3f d = bounded[i].position - p;
+                if (dotProduct(d, d) <= bounded[i].radius2)
+                    visit(bounded[i].light);
+            }
+        });
+    }
+
+    // Unbiased estimate of the sum over ForEachLight(p) from about numSamples
+    // lights: visit(lightIndex, weight) is called for the sampled lights, whose
+    // contributions are to be scaled by weight. Lights are picked in proportion
+    // to their intensity by systematic sampling with the offset u in [0, 1), so
+    // a light brighter than the sampling step is always taken. Points reached by
+    // at most numSamples lights visit all of them with weight 1.
+    template <typename Visit>
+    void SampleLights(const Vector3f& p, int numSamples, float u, Visit&& visit) const
+    {
+        float total = 0;
+        int reached = 0;
+        ForEachLight(p, [&](uint32_t l) {
+            total += importance[l];
+            ++reached;
+        });
+        if (reached <= numSamples || total <= 0)
+        {
+            ForEachLight(p, [&](uint32_t l) { visit(l, 1.f); });
+            return;
+        }
+        const float step = total / numSamples;
+        float next = u * step, sum = 0;
+        int taken = 0;
+        ForEachLight(p, [&](uint32_t l) {
+            sum += importance[l];
+            int picks = 0;
+            for (; next < sum && taken < numSamples; next += step, ++taken)
+                ++picks;
+            if (picks)
+                visit(l, picks * step / importance[l]);
+        });
+    }
+
+private:
+    struct BoundedLight
+    {
+        Vector3f position;
+        float radius2;
+        uint32_t light; // index into the scene's lights
+    };
+
+    BVH bvh;
+    std::vector<BoundedLight> bounded; // in leaf order
+    std::vector<uint32_t> unbounded;
+    std::vector<float> importance; // per light
+};
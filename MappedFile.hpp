@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only private mapping of a whole file, unmapped on destruction.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw "mapped file error:file cannot open";
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      throw "mapped file error:empty file";
+    }
+    length = st.st_size;
+    void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      throw "mapped file error:mmap failed";
+    }
+    base = static_cast<const uint8_t *>(p);
+  }
+  ~MappedFile() { ::munmap(const_cast<uint8_t *>(base), length); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return base; }
+  size_t size() const { return length; }
+
+  // count Ts at offset, after checking that they lie inside the file
+  template <typename T> const T *at(uint64_t offset, uint64_t count) const {
+    if (offset % alignof(T) != 0 || offset > length ||
+        count > (length - offset) / sizeof(T)) {
+      throw "mapped file error:truncated or corrupt file";
+    }
+    return reinterpret_cast<const T *>(base + offset);
+  }
+
+private:
+  const uint8_t *base;
+  size_t length;
+};
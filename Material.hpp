@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Vector.hpp"
+#include "global.hpp"
+
+#include <cstdint>
+
+// Shading parameters shared by any number of objects. Objects refer to their
+// material by index into Scene's material table (see Scene::AddMaterial), so
+// intersection data does not carry them around.
+struct Material
+{
+    MaterialType materialType = DIFFUSE_AND_GLOSSY;
+    float ior = 1.3;
+    float Kd = 0.8, Ks = 0.2;
+    Vector3f diffuseColor = Vector3f(0.2);
+    float specularExponent = 25;
+
+    bool operator==(const Material& o) const
+    {
+        return materialType == o.materialType && ior == o.ior && Kd == o.Kd && Ks == o.Ks &&
+               diffuseColor.x == o.diffuseColor.x && diffuseColor.y == o.diffuseColor.y &&
+               diffuseColor.z == o.diffuseColor.z && specularExponent == o.specularExponent;
+    }
+};
+
+// Fresnel reflectance at normal incidence of a surface with index of refraction ior
+inline float fresnel_r0(float ior)
+{
+    const float r = (1 - ior) / (1 + ior);
+    return r * r;
+}
+
+// Terms of the shading of a Material that depend on nothing else, computed once
+// when it enters a scene's material table instead of per hit.
+struct MaterialFactors
+{
+    explicit MaterialFactors(const Material& m)
+        : fresnelR0(fresnel_r0(m.ior))
+    {}
+
+    float fresnelR0;
+};
+
+// index into the scene's material table; 0 is the default Material
+using MaterialId = uint32_t;
@@ -0,0 +1,645 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+#include "Vector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Triangle mesh read from a file, in the layout MeshTriangle takes: one index per
+// corner into both vertices and st (zero where the file has none).
+struct MeshData {
+  std::vector<Vector3f> vertices;
+  std::vector<Vector2f> st;
+  std::vector<uint32_t> indices;
+};
+
+namespace mesh_detail {
+
+// bytes of OBJ text parsed per task
+constexpr size_t kChunkBytes = 1 << 20;
+// PLY lines or faces parsed per task
+constexpr size_t kBlockItems = 1 << 14;
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline void skip_blanks(const char *&p, const char *end) {
+  while (p < end && is_blank(*p))
+    ++p;
+}
+
+inline const char *next_line(const char *p, const char *end) {
+  if (p >= end)
+    return end;
+  const void *nl = memchr(p, '\n', (size_t)(end - p));
+  return nl ? static_cast<const char *>(nl) + 1 : end;
+}
+
+// Decimal number with optional sign, fraction and exponent, without locale or
+// allocation. The first 19 significant digits are kept exactly and scaled once,
+// which is exact to float precision for anything an exporter writes.
+inline bool parse_float(const char *&p, const char *end, float &out) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                 1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*s - '0');
+      digits += mantissa != 0;
+    } else {
+      ++exponent;
+    }
+  }
+  if (s < end && *s == '.') {
+    for (++s; s < end && *s >= '0' && *s <= '9'; ++s, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        digits += mantissa != 0;
+        --exponent;
+      }
+    }
+  }
+  if (!any)
+    return false;
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char *e = s + 1;
+    bool negative_exp = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      negative_exp = *e++ == '-';
+    if (e < end && *e >= '0' && *e <= '9') {
+      int value = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; ++e)
+        value = std::min(value * 10 + (*e - '0'), 1000);
+      exponent += negative_exp ? -value : value;
+      s = e;
+    }
+  }
+  double v = (double)mantissa;
+  if (mantissa != 0) {
+    while (exponent > 22) {
+      v *= 1e22;
+      exponent -= 22;
+    }
+    while (exponent < -22) {
+      v /= 1e22;
+      exponent += 22;
+    }
+    v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+  }
+  out = (float)(negative ? -v : v);
+  p = s;
+  return true;
+}
+
+inline bool parse_int(const char *&p, const char *end, long &out) {
+  const char *s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+  if (s == end || *s < '0' || *s > '9')
+    return false;
+  long v = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s)
+    v = std::min(v * 10 + (*s - '0'), 1L << 40);
+  out = negative ? -v : v;
+  p = s;
+  return true;
+}
+
+// texture index of a corner without one
+constexpr uint32_t kNoTexture = UINT32_MAX;
+
+// Replaces the (position, texture) index pairs of the corners by one index into
+// merged vertices. Positions that are always used with the texture coordinate
+// of the same index (or none) keep their index, so the common case costs one
+// pass and no extra memory.
+inline void merge_corners(std::vector<Vector3f> &positions,
+                          std::vector<Vector2f> &texcoords,
+                          std::vector<uint32_t> &tex_indices, MeshData &mesh) {
+  bool same = true;
+  for (size_t c = 0; c < tex_indices.size() && same; ++c)
+    same = tex_indices[c] == kNoTexture || tex_indices[c] == mesh.indices[c];
+  if (same) {
+    mesh.st.assign(positions.size(), Vector2f(0, 0));
+    for (size_t c = 0; c < tex_indices.size(); ++c)
+      if (tex_indices[c] != kNoTexture)
+        mesh.st[mesh.indices[c]] = texcoords[tex_indices[c]];
+    mesh.vertices = std::move(positions);
+    return;
+  }
+  std::unordered_map<uint64_t, uint32_t> ids;
+  for (size_t c = 0; c < mesh.indices.size(); ++c) {
+    const uint64_t key = (uint64_t)mesh.indices[c] << 32 | tex_indices[c];
+    auto [it, inserted] = ids.emplace(key, mesh.vertices.size());
+    if (inserted) {
+      mesh.vertices.push_back(positions[mesh.indices[c]]);
+      mesh.st.push_back(tex_indices[c] != kNoTexture ? texcoords[tex_indices[c]] : Vector2f(0, 0));
+    }
+    mesh.indices[c] = it->second;
+  }
+}
+
+// Wavefront OBJ, v/vt/f statements. The file is split into chunks at line
+// boundaries; a first parallel pass counts the statements of every chunk, which
+// gives each chunk its output ranges, and a second one parses straight into
+// the final arrays.
+inline MeshData load_obj(const MappedFile &file, ThreadPool &pool) {
+  const char *begin = reinterpret_cast<const char *>(file.data());
+  const char *end = begin + file.size();
+  struct Chunk {
+    const char *begin, *end;
+    size_t v = 0, vt = 0, tris = 0; // counts, then first output index
+  };
+  std::vector<Chunk> chunks((file.size() + kChunkBytes - 1) / kChunkBytes);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].begin = i ? chunks[i - 1].end : begin;
+    chunks[i].end = i + 1 < chunks.size()
+                        ? std::max(chunks[i].begin, next_line(begin + (i + 1) * kChunkBytes - 1, end))
+                        : end;
+  }
+
+  pool.parallel_for(chunks.size(), [&](size_t i, unsigned) {
+    Chunk &chunk = chunks[i];
+    for (const char *p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end)) {
+      skip_blanks(p, chunk.end);
+      if (chunk.end - p < 2)
+        continue;
+      if (p[0] == 'v' && is_blank(p[1])) {
+        ++chunk.v;
+      } else if (p[0] == 'v' && p[1] == 't' && chunk.end - p > 2 && is_blank(p[2])) {
+        ++chunk.vt;
+      } else if (p[0] == 'f' && is_blank(p[1])) {
+        const char *line_end = next_line(p, chunk.end);
+        int corners = 0;
+        for (const char *q = p + 1; q < line_end;) {
+          skip_blanks(q, line_end);
+          if (q == line_end || *q == '\n')
+            break;
+          ++corners;
+          while (q < line_end && !is_blank(*q) && *q != '\n')
+            ++q;
+        }
+        chunk.tris += std::max(corners - 2, 0);
+      }
+    }
+  });
+  size_t num_v = 0, num_vt = 0, num_tris = 0;
+  for (Chunk &chunk : chunks) {
+    std::swap(num_v, chunk.v);
+    std::swap(num_vt, chunk.vt);
+    std::swap(num_tris, chunk.tris);
+    num_v += chunk.v;
+    num_vt += chunk.vt;
+    num_tris += chunk.tris;
+  }
+
+  std::vector<Vector3f> positions(num_v);
+  std::vector<Vector2f> texcoords(num_vt);
+  std::vector<uint32_t> tex_indices(num_vt ? num_tris * 3 : 0);
+  MeshData mesh;
+  mesh.indices.resize(num_tris * 3);
+  pool.parallel_for(chunks.size(), [&](size_t i, unsigned) {
+    const Chunk &chunk = chunks[i];
+    size_t v = chunk.v, vt = chunk.vt, corner = chunk.tris * 3;
+    long face[2][3];
+    for (const char *p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end)) {
+      skip_blanks(p, chunk.end);
+      if (chunk.end - p < 2)
+        continue;
+      const char *line_end = next_line(p, chunk.end);
+      if (p[0] == 'v' && is_blank(p[1])) {
+        p += 2;
+        float xyz[3];
+        for (float &c : xyz) {
+          skip_blanks(p, line_end);
+          if (!parse_float(p, line_end, c)) {
+            throw "load mesh error:bad OBJ vertex";
+          }
+        }
+        positions[v++] = Vector3f(xyz[0], xyz[1], xyz[2]);
+      } else if (p[0] == 'v' && p[1] == 't' && chunk.end - p > 2 && is_blank(p[2])) {
+        p += 3;
+        float st[2] = {0, 0};
+        for (float &c : st) {
+          skip_blanks(p, line_end);
+          parse_float(p, line_end, c);
+        }
+        texcoords[vt++] = Vector2f(st[0], st[1]);
+      } else if (p[0] == 'f' && is_blank(p[1])) {
+        p += 2;
+        for (int k = 0;; ++k) {
+          skip_blanks(p, line_end);
+          if (p == line_end || *p == '\n')
+            break;
+          // "v", "v/vt", "v//vn" or "v/vt/vn"
+          long pos, tex = 0, normal;
+          bool ok = parse_int(p, line_end, pos);
+          if (ok && p < line_end && *p == '/') {
+            ++p;
+            if (p < line_end && *p != '/')
+              ok = parse_int(p, line_end, tex);
+            if (ok && p < line_end && *p == '/') {
+              ++p;
+              ok = parse_int(p, line_end, normal);
+            }
+          }
+          // the token count of the first pass has to match
+          ok = ok && (p == line_end || is_blank(*p) || *p == '\n');
+          // 1-based, or relative to the statements read so far when negative
+          pos = pos < 0 ? (long)v + pos : pos - 1;
+          tex = tex == 0 ? -1 : tex < 0 ? (long)vt + tex : tex - 1;
+          if (!ok || pos < 0 || pos >= (long)num_v || (tex != -1 && (tex < 0 || tex >= (long)num_vt))) {
+            throw "load mesh error:bad OBJ face";
+          }
+          // fan around the first corner
+          if (k < 2) {
+            face[0][k] = pos;
+            face[1][k] = tex;
+            continue;
+          }
+          face[0][2] = pos;
+          face[1][2] = tex;
+          for (int c = 0; c < 3; ++c) {
+            mesh.indices[corner + c] = face[0][c];
+            if (!tex_indices.empty())
+              tex_indices[corner + c] = face[1][c] < 0 ? kNoTexture : face[1][c];
+          }
+          corner += 3;
+          face[0][1] = pos;
+          face[1][1] = tex;
+        }
+      }
+    }
+  });
+  merge_corners(positions, texcoords, tex_indices, mesh);
+  return mesh;
+}
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+inline bool ply_type(const std::string &name, PlyType &type) {
+  static const std::pair<const char *, PlyType> names[] = {
+      {"char", PlyType::Int8},     {"int8", PlyType::Int8},
+      {"uchar", PlyType::UInt8},   {"uint8", PlyType::UInt8},
+      {"short", PlyType::Int16},   {"int16", PlyType::Int16},
+      {"ushort", PlyType::UInt16}, {"uint16", PlyType::UInt16},
+      {"int", PlyType::Int32},     {"int32", PlyType::Int32},
+      {"uint", PlyType::UInt32},   {"uint32", PlyType::UInt32},
+      {"float", PlyType::Float32}, {"float32", PlyType::Float32},
+      {"double", PlyType::Float64}, {"float64", PlyType::Float64}};
+  for (const auto &n : names) {
+    if (name == n.first) {
+      type = n.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline size_t ply_size(PlyType type) {
+  static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+  return sizes[(int)type];
+}
+
+// one binary value, byte swapped when the file's byte order is not ours
+inline double ply_read(const uint8_t *p, PlyType type, bool swap) {
+  uint8_t b[8];
+  const size_t n = ply_size(type);
+  for (size_t i = 0; i < n; ++i)
+    b[i] = swap ? p[n - 1 - i] : p[i];
+  switch (type) {
+  case PlyType::Int8: return (int8_t)b[0];
+  case PlyType::UInt8: return b[0];
+  case PlyType::Int16: { int16_t v; memcpy(&v, b, 2); return v; }
+  case PlyType::UInt16: { uint16_t v; memcpy(&v, b, 2); return v; }
+  case PlyType::Int32: { int32_t v; memcpy(&v, b, 4); return v; }
+  case PlyType::UInt32: { uint32_t v; memcpy(&v, b, 4); return v; }
+  case PlyType::Float32: { float v; memcpy(&v, b, 4); return v; }
+  default: { double v; memcpy(&v, b, 8); return v; }
+  }
+}
+
+// Reads the count of a binary list at q and steps past it. The count must be a
+// whole number of items that fit before end.
+inline size_t ply_list_count(const char *&q, const char *end, PlyType count_type,
+                             PlyType type, bool swap) {
+  if ((size_t)(end - q) < ply_size(count_type)) {
+    throw "load mesh error:truncated PLY file";
+  }
+  const double n = ply_read(reinterpret_cast<const uint8_t *>(q), count_type, swap);
+  q += ply_size(count_type);
+  if (!(n >= 0) || n != std::floor(n) ||
+      n > (double)((size_t)(end - q) / ply_size(type))) {
+    throw "load mesh error:truncated PLY file";
+  }
+  return (size_t)n;
+}
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;           // the item type for lists
+  bool list = false;
+  PlyType count_type;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count = 0;
+  std::vector<PlyProperty> properties;
+};
+
+// PLY in ascii, binary_little_endian or binary_big_endian form: vertex x, y, z
+// and optional s/t (or u/v) properties, and the vertex_indices list of faces.
+// Vertices and faces are parsed in parallel blocks; binary faces and ascii lines
+// are located by a cheap serial scan first since their size varies.
+inline MeshData load_ply(const MappedFile &file, ThreadPool &pool) {
+  const char *begin = reinterpret_cast<const char *>(file.data());
+  const char *end = begin + file.size();
+
+  // header
+  std::vector<PlyElement> elements;
+  enum { Ascii, Little, Big } format = Ascii;
+  const char *p = begin;
+  auto token = [&](const char *&q, const char *line_end) {
+    skip_blanks(q, line_end);
+    const char *t = q;
+    while (q < line_end && !is_blank(*q) && *q != '\n')
+      ++q;
+    return std::string(t, q);
+  };
+  {
+    const char *line_end = next_line(p, end);
+    if (token(p, line_end) != "ply") {
+      throw "load mesh error:not a PLY file";
+    }
+    p = line_end;
+  }
+  while (true) {
+    if (p == end) {
+      throw "load mesh error:bad PLY header";
+    }
+    const char *line_end = next_line(p, end);
+    std::string keyword = token(p, line_end);
+    if (keyword == "format") {
+      std::string f = token(p, line_end);
+      format = f == "ascii" ? Ascii : f == "binary_little_endian" ? Little : Big;
+      if (format == Big && f != "binary_big_endian") {
+        throw "load mesh error:bad PLY format";
+      }
+    } else if (keyword == "element") {
+      PlyElement e;
+      e.name = token(p, line_end);
+      std::string count = token(p, line_end);
+      const char *c = count.c_str();
+      long n;
+      if (!parse_int(c, c + count.size(), n) || n < 0) {
+        throw "load mesh error:bad PLY header";
+      }
+      e.count = n;
+      elements.push_back(e);
+    } else if (keyword == "property") {
+      if (elements.empty()) {
+        throw "load mesh error:bad PLY header";
+      }
+      PlyProperty prop;
+      std::string type = token(p, line_end);
+      if (type == "list") {
+        prop.list = true;
+        if (!ply_type(token(p, line_end), prop.count_type)) {
+          throw "load mesh error:bad PLY header";
+        }
+        type = token(p, line_end);
+      }
+      if (!ply_type(type, prop.type)) {
+        throw "load mesh error:bad PLY header";
+      }
+      prop.name = token(p, line_end);
+      elements.back().properties.push_back(prop);
+    } else if (keyword == "end_header") {
+      p = line_end;
+      break;
+    }
+    p = line_end;
+  }
+  const bool swap = format == Big; // binary_little_endian is the host order here
+
+  MeshData mesh;
+  std::vector<Vector3f> positions;
+  std::vector<Vector2f> texcoords;
+  for (const PlyElement &e : elements) {
+    const bool is_vertex = e.name == "vertex", is_face = e.name == "face";
+    int vx = -1, vy = -1, vz = -1, vs = -1, vt = -1, list = -1;
+    for (int k = 0; k < (int)e.properties.size(); ++k) {
+      const std::string &n = e.properties[k].name;
+      if (n == "x") vx = k;
+      else if (n == "y") vy = k;
+      else if (n == "z") vz = k;
+      else if (n == "s" || n == "u" || n == "texture_u" || n == "texture_s") vs = k;
+      else if (n == "t" || n == "v" || n == "texture_v" || n == "texture_t") vt = k;
+      else if (n == "vertex_indices" || n == "vertex_index") list = k;
+    }
+    if (is_vertex && (vx < 0 || vy < 0 || vz < 0)) {
+      throw "load mesh error:PLY vertices without x, y, z";
+    }
+    if (is_face && list < 0) {
+      throw "load mesh error:PLY faces without vertex_indices";
+    }
+    const bool has_st = vs >= 0 && vt >= 0;
+
+    // start of every block of kBlockItems items, and of the next element
+    std::vector<const char *> blocks;
+    // faces: triangles before every block, then their total
+    std::vector<size_t> block_tris;
+    if (format == Ascii) {
+      const char *q = p;
+      for (size_t i = 0; i < e.count; ++i) {
+        if (q == end) {
+          throw "load mesh error:truncated PLY file";
+        }
+        if (i % kBlockItems == 0)
+          blocks.push_back(q);
+        q = next_line(q, end);
+      }
+      blocks.push_back(q);
+    } else {
+      size_t fixed = 0;
+      bool has_list = false;
+      for (const PlyProperty &prop : e.properties) {
+        has_list |= prop.list;
+        if (!prop.list)
+          fixed += ply_size(prop.type);
+      }
+      const char *q = p;
+      for (size_t i = 0; i < e.count; ++i) {
+        if (i % kBlockItems == 0)
+          blocks.push_back(q);
+        if (!has_list) {
+          if ((size_t)(end - q) < fixed) {
+            throw "load mesh error:truncated PLY file";
+          }
+          q += fixed;
+          continue;
+        }
+        for (const PlyProperty &prop : e.properties) {
+          if (prop.list) {
+            q += ply_list_count(q, end, prop.count_type, prop.type, swap) * ply_size(prop.type);
+            continue;
+          }
+          if ((size_t)(end - q) < ply_size(prop.type)) {
+            throw "load mesh error:truncated PLY file";
+          }
+          q += ply_size(prop.type);
+        }
+      }
+      blocks.push_back(q);
+    }
+    const size_t num_blocks = blocks.size() - 1;
+
+    // the properties of one item; lists go to corners (for faces) or are skipped
+    auto parse_item = [&](const char *&q, const char *item_end, double *values,
+                          std::vector<long> &corners) {
+      for (size_t k = 0; k < e.properties.size(); ++k) {
+        const PlyProperty &prop = e.properties[k];
+        if (format == Ascii) {
+          skip_blanks(q, item_end);
+          if (!prop.list) {
+            float f;
+            if (!parse_float(q, item_end, f)) {
+              throw "load mesh error:bad PLY data";
+            }
+            values[k] = f;
+            continue;
+          }
+          long n;
+          if (!parse_int(q, item_end, n) || n < 0) {
+            throw "load mesh error:bad PLY data";
+          }
+          for (long c = 0; c < n; ++c) {
+            long index;
+            skip_blanks(q, item_end);
+            if (!parse_int(q, item_end, index)) {
+              throw "load mesh error:bad PLY data";
+            }
+            if ((int)k == list)
+              corners.push_back(index);
+          }
+        } else {
+          if (!prop.list) {
+            if ((size_t)(item_end - q) < ply_size(prop.type)) {
+              throw "load mesh error:truncated PLY file";
+            }
+            values[k] = ply_read(reinterpret_cast<const uint8_t *>(q), prop.type, swap);
+            q += ply_size(prop.type);
+            continue;
+          }
+          const size_t n = ply_list_count(q, item_end, prop.count_type, prop.type, swap);
+          for (size_t c = 0; c < n; ++c, q += ply_size(prop.type))
+            if ((int)k == list)
+              corners.push_back((long)ply_read(reinterpret_cast<const uint8_t *>(q), prop.type, swap));
+        }
+      }
+    };
+    auto item_end = [&](const char *q, const char *block_end) {
+      return format == Ascii ? next_line(q, block_end) : block_end;
+    };
+
+    if (is_vertex) {
+      positions.resize(e.count);
+      if (has_st)
+        texcoords.resize(e.count);
+      pool.parallel_for(num_blocks, [&](size_t b, unsigned) {
+        std::vector<double> values(e.properties.size());
+        std::vector<long> unused;
+        const char *q = blocks[b];
+        const size_t last = std::min(e.count, (b + 1) * kBlockItems);
+        for (size_t i = b * kBlockItems; i < last; ++i) {
+          const char *line_end = item_end(q, blocks[b + 1]);
+          parse_item(q, line_end, values.data(), unused);
+          positions[i] = Vector3f(values[vx], values[vy], values[vz]);
+          if (has_st)
+            texcoords[i] = Vector2f(values[vs], values[vt]);
+          if (format == Ascii)
+            q = line_end;
+        }
+      });
+    } else if (is_face) {
+      // pass 1 counts the triangles of every block, pass 2 writes them
+      block_tris.assign(num_blocks + 1, 0);
+      for (int pass = 0; pass < 2; ++pass) {
+        pool.parallel_for(num_blocks, [&](size_t b, unsigned) {
+          std::vector<double> values(e.properties.size());
+          std::vector<long> corners;
+          size_t tri = pass ? block_tris[b] : 0;
+          const char *q = blocks[b];
+          const size_t last = std::min(e.count, (b + 1) * kBlockItems);
+          for (size_t i = b * kBlockItems; i < last; ++i) {
+            const char *line_end = item_end(q, blocks[b + 1]);
+            corners.clear();
+            parse_item(q, line_end, values.data(), corners);
+            if (format == Ascii)
+              q = line_end;
+            if (corners.size() < 3)
+              continue;
+            if (pass == 0) {
+              tri += corners.size() - 2;
+              continue;
+            }
+            for (size_t c = 2; c < corners.size(); ++c, ++tri) {
+              const long fan[3] = {corners[0], corners[c - 1], corners[c]};
+              for (int k = 0; k < 3; ++k) {
+                if (fan[k] < 0 || fan[k] >= (long)positions.size()) {
+                  throw "load mesh error:bad PLY face";
+                }
+                mesh.indices[tri * 3 + k] = fan[k];
+              }
+            }
+          }
+          if (pass == 0)
+            block_tris[b] = tri;
+        });
+        if (pass == 0) {
+          size_t total = 0;
+          for (size_t &t : block_tris)
+            std::swap(total, t), total += t;
+          mesh.indices.resize(block_tris[num_blocks] * 3);
+        }
+      }
+    }
+    p = blocks.back();
+  }
+  if (positions.empty()) {
+    throw "load mesh error:PLY file without vertices";
+  }
+  std::vector<uint32_t> tex_indices;
+  if (!texcoords.empty())
+    tex_indices.assign(mesh.indices.begin(), mesh.indices.end());
+  merge_corners(positions, texcoords, tex_indices, mesh);
+  return mesh;
+}
+
+} // namespace mesh_detail
+
+// Loads a triangle mesh from an .obj or .ply file, picked by the extension, on
+// the threads of pool. Polygons are split into triangle fans. The file is read
+// through a mapping and parsed straight into arrays sized by a counting pass,
+// so no intermediate copy of the mesh is built.
+inline MeshData load_mesh(const std::string &path, ThreadPool &pool) {
+  MappedFile file(path);
+  const size_t n = path.size();
+  if (n >= 4 && path.compare(n - 4, 4, ".ply") == 0)
+    return mesh_detail::load_ply(file, pool);
+  return mesh_detail::load_obj(file, pool);
+}
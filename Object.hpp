@@ -1,19 +1,15 @@
 #pragma once
 
+#include "Bounds3.hpp"
+#include "Material.hpp"
+#include "RayPacket.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
 
 class Object
 {
 public:
-    Object()
-        : materialType(DIFFUSE_AND_GLOSSY)
-        , ior(1.3)
-        , Kd(0.8)
-        , Ks(0.2)
-        , diffuseColor(0.2)
-        , specularExponent(25)
-    {}
+    Object() = default;
 
     virtual ~Object() = default;
 
@@ -22,15 +18,51 @@ public:
     virtual void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&, Vector3f&,
                                       Vector2f&) const = 0;
 
-    virtual Vector3f evalDiffuseColor(const Vector2f&) const
+    virtual Bounds3 getBounds() const = 0;
+
+    // Any-hit query: whether the object is hit at some 0 <= t < tMax. Shadow rays
+    // only need this, and implementations may stop at the first hit they find.
+    virtual bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const
+    {
+        float tK = kInfinity;
+        uint32_t indexK;
+        Vector2f uvK;
+        return intersect(orig, dir, tK, indexK, uvK) && tK < tMax;
+    }
+
+    // Packet query: for each lane of activeMask whose hit on this object is closer
+    // than tNear, shrinks that lane of tNear and fills index/uv like intersect().
+    // Returns the mask of those lanes. The default runs intersect() per lane.
+    virtual int intersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, uint32_t index[4],
+                                Vector2f uv[4]) const
+    {
+        float t[4];
+        tNear.storeu(t);
+        int hitMask = 0;
+        for (int i = 0; i < RayPacket4::kSize; ++i)
+        {
+            if (!(activeMask & (1 << i)))
+                continue;
+            float tK = kInfinity;
+            uint32_t indexK;
+            Vector2f uvK;
+            if (intersect(rays.o.lane(i), rays.d.lane(i), tK, indexK, uvK) && tK < t[i])
+            {
+                t[i] = tK;
+                index[i] = indexK;
+                uv[i] = uvK;
+                hitMask |= 1 << i;
+            }
+        }
+        tNear = float4::loadu(t);
+        return hitMask;
+    }
+
+    // diffuse color of the object's material at st; objects may override it with a texture
+    virtual Vector3f evalDiffuseColor(const Material& material, const Vector2f&) const
     {
-        return diffuseColor;
+        return material.diffuseColor;
     }
 
-    // material properties
-    MaterialType materialType;
-    float ior;
-    float Kd, Ks;
-    Vector3f diffuseColor;
-    float specularExponent;
+    MaterialId materialId = 0;
 };
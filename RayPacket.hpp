@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Bounds3.hpp"
+#include "Simd.hpp"
+#include "Vector.hpp"
+
+#include <cstdint>
+
+// Three float4 lanes, one Vector3f per lane in structure-of-arrays form.
+struct Vector3f4
+{
+    Vector3f4() = default;
+    Vector3f4(const float4& xx, const float4& yy, const float4& zz)
+        : x(xx)
+        , y(yy)
+        , z(zz)
+    {}
+    // broadcast one vector to every lane
+    explicit Vector3f4(const Vector3f& v)
+        : x(v.x)
+        , y(v.y)
+        , z(v.z)
+    {}
+
+    Vector3f4 operator+(const Vector3f4& o) const { return {x + o.x, y + o.y, z + o.z}; }
+    Vector3f4 operator-(const Vector3f4& o) const { return {x - o.x, y - o.y, z - o.z}; }
+    Vector3f4 operator*(const float4& r) const { return {x * r, y * r, z * r}; }
+
+    Vector3f lane(int i) const { return Vector3f(x[i], y[i], z[i]); }
+
+    float4 x, y, z;
+};
+
+inline float4 dotProduct(const Vector3f4& a, const Vector3f4& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vector3f4 crossProduct(const Vector3f4& a, const Vector3f4& b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+// Four rays traced together. Queries take a lane mask (bit i for lane i); lanes
+// outside it are never tested, so unused lanes only need a finite ray.
+struct RayPacket4
+{
+    static constexpr int kSize = 4;
+    static constexpr int kAllLanes = (1 << kSize) - 1;
+
+    RayPacket4(const Vector3f orig[kSize], const Vector3f dir[kSize])
+        : o(float4(orig[0].x, orig[1].x, orig[2].x, orig[3].x), float4(orig[0].y, orig[1].y, orig[2].y, orig[3].y),
+            float4(orig[0].z, orig[1].z, orig[2].z, orig[3].z))
+        , d(float4(dir[0].x, dir[1].x, dir[2].x, dir[3].x), float4(dir[0].y, dir[1].y, dir[2].y, dir[3].y),
+            float4(dir[0].z, dir[1].z, dir[2].z, dir[3].z))
+        , invDir(float4(1) / d.x, float4(1) / d.y, float4(1) / d.z)
+    {}
+    RayPacket4(const Vector3f4& orig, const Vector3f4& dir)
+        : o(orig)
+        , d(dir)
+        , invDir(float4(1) / d.x, float4(1) / d.y, float4(1) / d.z)
+    {}
+
+    Vector3f4 o, d, invDir;
+};
+
+// Packet version of Bounds3::IntersectP: lane mask of the rays that enter the box
+// within [0, tMax]. NaN slabs are ignored per lane, as in the scalar test.
+inline int IntersectP(const Bounds3& b, const RayPacket4& rays, const float4& tMax)
+{
+    const float4 widen(1 + 2 * Bounds3::kSlabGamma);
+    float4 t0(0.f), t1 = tMax;
+    const float4 pMin[3] = {float4(b.pMin.x), float4(b.pMin.y), float4(b.pMin.z)};
+    const float4 pMax[3] = {float4(b.pMax.x), float4(b.pMax.y), float4(b.pMax.z)};
+    const float4* orig[3] = {&rays.o.x, &rays.o.y, &rays.o.z};
+    const float4* inv[3] = {&rays.invDir.x, &rays.invDir.y, &rays.invDir.z};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float4 tA = (pMin[axis] - *orig[axis]) * *inv[axis];
+        float4 tB = (pMax[axis] - *orig[axis]) * *inv[axis];
+        float4 tNear = min(tA, tB);
+        float4 tFar = max(tA, tB) * widen;
+        t0 = max(tNear, t0);
+        t1 = min(tFar, t1);
+    }
+    return (t0 <= t1).bits();
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include "FrameBuffer.hpp"
+#include "ImageWriter.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Long-lived render service over a pair of streams (a pipe, or a socket
+// wrapped in streams). The scene and its acceleration structures stay
+// resident; commands edit the scene in place and rebuild only what they touch,
+// and frames go back without touching disk. One command per line:
+//
+//   camera ex ey ez tx ty tz [ux uy uz]   eye, look-at target and up
+//   fov degrees
+//   lens aperture focus-distance          aperture 0 for a pinhole
+//   size width height                      at most 8192 each
+//   background r g b
+//   light index px py pz ir ig ib [radius] index == light count adds one
+//   material id type ior kd ks r g b exponent
+//   render [passes]
+//   quit
+//
+// Every command is answered with "ok" or "error <message>" on its own line,
+// except render, answered with "frame <passes> <milliseconds> <bytes>" and a
+// binary PPM of that many bytes. passes counts the samples per pixel in the
+// frame: a render with nothing changed since the last one adds its passes to
+// the previous ones, so an idle client can keep refining a still image, and
+// any edit restarts from the pixel centers.
+class RenderServer {
+public:
+  RenderServer(Scene &scene, Renderer &renderer)
+      : scene(scene), renderer(renderer) {}
+
+  // reads commands from in until quit or end of input
+  void Serve(std::istream &in, std::ostream &out) {
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.empty())
+        continue;
+      try {
+        if (!Handle(line, out))
+          break;
+      } catch (const char *message) {
+        out << "error " << message << "\n";
+      } catch (const std::exception &e) {
+        // e.g. std::bad_alloc: the command failed, the server lives on
+        out << "error server error:" << e.what() << "\n";
+      }
+      out.flush();
+    }
+  }
+
+  // runs one command line; false after quit
+  bool Handle(const std::string &line, std::ostream &out) {
+    std::istringstream args(line);
+    std::string command;
+    args >> command;
+    if (command == "quit") {
+      out << "ok\n";
+      return false;
+    }
+    if (command == "render") {
+      int passes = 1;
+      args >> passes;
+      if (args.fail() && !args.eof())
+        throw "server error:bad arguments";
+      render(std::max(passes, 1), out);
+      return true;
+    }
+
+    if (command == "camera") {
+      Vector3f eye = read_vector(args), target = read_vector(args);
+      Vector3f up(0, 1, 0);
+      if (!(args >> std::ws).eof())
+        up = read_vector(args);
+      scene.camera.LookAt(eye, target, up);
+    } else if (command == "fov") {
+      scene.camera.fov = read_float(args);
+    } else if (command == "lens") {
+      const float aperture = read_float(args);
+      scene.camera.focusDistance = read_float(args);
+      scene.camera.aperture = aperture;
+    } else if (command == "size") {
+      const int w = read_int(args, 1, kMaxImageSize),
+                h = read_int(args, 1, kMaxImageSize);
+      scene.width = w;
+      scene.height = h;
+    } else if (command == "background") {
+      scene.backgroundColor = read_vector(args);
+    } else if (command == "light") {
+      const size_t index = read_int(args, 0, INT_MAX);
+      const Vector3f position = read_vector(args), intensity = read_vector(args);
+      float radius = kInfinity;
+      if (!(args >> std::ws).eof())
+        radius = read_float(args);
+      if (index == scene.get_lights().size()) {
+        // rebuilds the light index itself
+        scene.Add(std::make_unique<Light>(position, intensity, radius));
+      } else if (index < scene.get_lights().size()) {
+        Light &light = scene.get_light(index);
+        light.position = position;
+        light.intensity = intensity;
+        light.radius = radius;
+        // the objects' BVH is untouched by a light edit
+        if (scene.get_compiled())
+          scene.compile_lights();
+      } else {
+        throw "server error:no such light";
+      }
+    } else if (command == "material") {
+      const MaterialId id = read_int(args, 0, INT_MAX);
+      Material material;
+      material.materialType =
+          (MaterialType)read_int(args, DIFFUSE_AND_GLOSSY, REFLECTION);
+      material.ior = read_float(args);
+      material.Kd = read_float(args);
+      material.Ks = read_float(args);
+      material.diffuseColor = read_vector(args);
+      material.specularExponent = read_float(args);
+      scene.SetMaterial(id, material);
+    } else {
+      throw "server error:unknown command";
+    }
+    passes_done = 0;
+    out << "ok\n";
+    return true;
+  }
+
+private:
+  // largest width or height a size command may ask for
+  static constexpr int kMaxImageSize = 8192;
+
+  // a whole integer token in [lo, hi]
+  static int read_int(std::istream &args, int lo, int hi) {
+    long long v;
+    if (!(args >> v) || v < lo || v > hi ||
+        !(args.peek() == EOF || std::isspace(args.peek())))
+      throw "server error:bad arguments";
+    return (int)v;
+  }
+  static float read_float(std::istream &args) {
+    float v;
+    if (!(args >> v))
+      throw "server error:bad arguments";
+    return v;
+  }
+  static Vector3f read_vector(std::istream &args) {
+    const float x = read_float(args), y = read_float(args);
+    return Vector3f(x, y, read_float(args));
+  }
+
+  void render(int passes, std::ostream &out) {
+    const auto start = std::chrono::steady_clock::now();
+    if (sum.get_width() != scene.width || sum.get_height() != scene.height)
+      passes_done = 0;
+    if (passes_done == 0)
+      sum.resize(scene.width, scene.height);
+    for (int p = 0; p < passes; ++p, ++passes_done) {
+      renderer.RenderPass(scene, passes_done);
+      const FrameBuffer &sample = renderer.get_frame_buffer();
+      for (int y = 0; y < scene.height; ++y)
+        for (int x = 0; x < scene.width; ++x)
+          sum.at(x, y) += sample.at(x, y);
+    }
+    frame.resize(scene.width, scene.height);
+    const float scale = 1.f / passes_done;
+    for (int y = 0; y < scene.height; ++y)
+      for (int x = 0; x < scene.width; ++x)
+        frame.at(x, y) = sum.at(x, y) * scale;
+    const std::vector<uint8_t> bytes = encode_ppm(frame);
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    out << "frame " << passes_done << " " << ms << " " << bytes.size() << "\n";
+    out.write((const char *)bytes.data(), bytes.size());
+  }
+
+  Scene &scene;
+  Renderer &renderer;
+  // running sum of the passes since the last edit
+  FrameBuffer sum, frame;
+  int passes_done = 0;
+};
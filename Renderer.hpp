@@ -1,183 +1,513 @@
 #pragma once
+#include "Arena.hpp"
+#include "FrameBuffer.hpp"
+#include "ImageWriter.hpp"
+#include "Integrator.hpp"
+#include "Sampler.hpp"
 #include "Scene.hpp"
-#include <optional>
-#include <vector>
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "Wavefront.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <iostream>
-#include <fstream>
+#include <string>
+#include <vector>
 
-constexpr float kInfinity = std::numeric_limits<float>::max();
+enum class RenderMode {
+  // tiles on the thread pool, each pixel's ray tree depth first
+  Tile,
+  // whole-frame ray batches per bounce, see WavefrontIntegrator
+  Wavefront
+};
 
-struct hit_payload {
-  float tNear;
-  uint32_t index;
-  Vector2f uv;
-  Object *hit_obj;
+// One frame of Renderer::RenderBatch().
+struct BatchFrame {
+  Camera camera;
+  std::string path; // the image format follows the extension
 };
 
-inline float deg2rad(const float &deg) { return deg * M_PI / 180.0; }
-
-inline Vector3f reflect(const Vector3f &I, const Vector3f &N) {
-  return I - 2 * dotProduct(I, N) * N;
-}
-
-inline Vector3f refract(const Vector3f &I, const Vector3f &N,
-                        const float &ior) {
-  float cosi = fabs(clamp(-1, 1, dotProduct(I, N)));
-  auto t=1 - 1/ior * 1/ior * (1 - cosi * cosi);
-  if(t<0) return 0;
-  float coso =sqrtf(t);
-  return 1/ior * I + (1/ior * cosi - coso) * N;
-}
-
-inline float fresnel(const Vector3f &I, const Vector3f &N, const float &ior) {
-  auto cosi = fabs(clamp(-1, 1, dotProduct(I, N)));
-  auto R0 = pow((1 - ior) / (1 + ior), 2);
-  return R0 + (1 - R0) * pow((1 - cosi), 5);
-}
-
-inline std::optional<hit_payload>
-trace(const Vector3f &orig, const Vector3f &dir,
-      const std::vector<std::unique_ptr<Object>> &objects) {
-  float tNear = kInfinity;
-  std::optional<hit_payload> payload;
-  for (const auto &object : objects) {
-    float tNearK = kInfinity;
-    uint32_t indexK;
-    Vector2f uvK;
-    if (object->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tNear) {
-      payload.emplace();
-      payload->hit_obj = object.get();
-      payload->tNear = tNearK;
-      payload->index = indexK;
-      payload->uv = uvK;
-      tNear = tNearK;
-    }
+struct ProgressiveStats {
+  int samples = 0;             // passes rendered, one sample per pixel each
+  size_t converged_pixels = 0; // 0 unless a convergence threshold is set
+  size_t camera_samples = 0;   // over all passes, fewer than passes * pixels when adaptive
+  double seconds = 0;
+};
+
+struct ProgressiveSettings {
+  // a pixel counts as converged after at least kMinSamples
+  static constexpr int kMinSamples = 4;
+  // relative errors are measured against at least this luminance
+  static constexpr float kMinLuminance = 1.f / 255;
+
+  int max_samples = 64;
+  // every this many passes an intermediate image goes to on_progress, or is
+  // written to the output path when there is no callback; 0 for none
+  int output_interval = 0;
+  // seconds, 0 for none
+  double time_budget = 0;
+  // stop once the standard error of every pixel's luminance is below this
+  // fraction of its mean; 0 for none
+  float convergence_threshold = 0;
+  // with a convergence threshold, stop sampling the tiles whose pixels have all
+  // converged, so later passes only go to the noisy tiles
+  bool adaptive = false;
+  std::function<void(const FrameBuffer &, const ProgressiveStats &)> on_progress;
+};
+
+class Renderer {
+public:
+  // edge length in pixels of the square tiles handed to the workers
+  static constexpr int kTileSize = 16;
+
+  // numThreads workers render tiles in parallel; 1 renders on the calling thread.
+  // Every pixel is computed independently, so the image does not depend on it.
+  explicit Renderer(unsigned numThreads = std::thread::hardware_concurrency())
+      : pool(numThreads) {
+    set_sampler(SamplerType::Sobol);
+  }
+
+  void Render(const Scene &scene) {
+    RenderPass(scene, 0);
+    write_image(output_path, frame_buffer, output_format);
+  }
+
+  // One sample per pixel into the frame buffer without writing an image, at
+  // the offsets of pass of RenderProgressive(): pass 0 renders as Render().
+  void RenderPass(const Scene &scene, int pass) {
+    frame_buffer.resize(scene.width, scene.height, layout);
+    begin_frame(scene);
+    render_samples(scene, scene.camera, pass, frame_buffer);
+    end_stats();
   }
-  return payload;
-}
-
-inline Vector3f castRay(const Vector3f &orig, const Vector3f &dir,
-                        const Scene &scene, int depth) {
-  if (depth > scene.maxDepth) {
-    return Vector3f(0.0, 0.0, 0.0);
-  }
-
-  Vector3f hitColor = scene.backgroundColor;
-  if (auto payload = trace(orig, dir, scene.get_objects()); payload) {
-    Vector3f hitPoint = orig + dir * payload->tNear;
-    Vector3f N;  // normal
-    Vector2f st; // st coordinates
-    payload->hit_obj->getSurfaceProperties(hitPoint, dir, payload->index,
-                                           payload->uv, N, st);
-    switch (payload->hit_obj->materialType) {
-    case REFLECTION_AND_REFRACTION: {
-      Vector3f reflectionDirection = normalize(reflect(dir, N));
-      Vector3f refractionDirection =
-          normalize(refract(dir, N, payload->hit_obj->ior));
-      Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0)
-                                       ? hitPoint - N * scene.epsilon
-                                       : hitPoint + N * scene.epsilon;
-      Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0)
-                                       ? hitPoint - N * scene.epsilon
-                                       : hitPoint + N * scene.epsilon;
-      Vector3f reflectionColor =
-          castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1);
-      Vector3f refractionColor =
-          castRay(refractionRayOrig, refractionDirection, scene, depth + 1);
-      float kr = fresnel(dir, N, payload->hit_obj->ior);
-      hitColor = reflectionColor * kr + refractionColor * (1 - kr);
-      break;
-    }
-    case REFLECTION: {
-      float kr = fresnel(dir, N, payload->hit_obj->ior);
-      Vector3f reflectionDirection = reflect(dir, N);
-      Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0)
-                                       ? hitPoint + N * scene.epsilon
-                                       : hitPoint - N * scene.epsilon;
-      hitColor =
-          castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1) *
-          kr;
-      break;
-    }
-    default: {
-      Vector3f lightAmt = 0, specularColor = 0;
-      Vector3f shadowPointOrig = (dotProduct(dir, N) < 0)
-                                     ? hitPoint + N * scene.epsilon
-                                     : hitPoint - N * scene.epsilon;
-      for (auto &light : scene.get_lights()) {
-        Vector3f lightDir = light->position - hitPoint;
-        float lightDistance2 = dotProduct(lightDir, lightDir);
-        lightDir = normalize(lightDir);
-        float LdotN = std::max(0.f, dotProduct(lightDir, N));
-        auto shadow_res = trace(shadowPointOrig, lightDir, scene.get_objects());
-        bool inShadow = shadow_res && (shadow_res->tNear * shadow_res->tNear <
-                                       lightDistance2);
-
-        lightAmt += inShadow ? 0 : light->intensity * LdotN;
-        Vector3f reflectionDirection = reflect(-lightDir, N);
-
-        specularColor +=
-            powf(std::max(0.f, -dotProduct(reflectionDirection, dir)),
-                 payload->hit_obj->specularExponent) *
-            light->intensity;
-      }
 
-      hitColor = lightAmt * payload->hit_obj->evalDiffuseColor(st) *
-                     payload->hit_obj->Kd +
-                 specularColor * payload->hit_obj->Ks;
-      break;
+  // Renders frames in order against the one scene, each from its own camera
+  // with samples passes per pixel averaged (the first at the pixel centers),
+  // and writes each to its path. Encoding and writing frame N runs on a thread
+  // of its own while frame N + 1 renders; the scene's camera is not used.
+  void RenderBatch(const Scene &scene, const std::vector<BatchFrame> &frames,
+                   int samples = 1) {
+    // a buffer is rendered into again once the frame written from it is done
+    FrameBuffer buffers[2];
+    std::future<void> writing;
+    for (size_t f = 0; f < frames.size(); ++f) {
+      FrameBuffer &target = buffers[f % 2];
+      target.resize(scene.width, scene.height, layout);
+      begin_frame(scene);
+      render_mean(scene, frames[f].camera, 0, samples, target);
+      end_stats();
+      if (writing.valid())
+        writing.get();
+      const BatchFrame &frame = frames[f];
+      writing = std::async(std::launch::async, [&target, &frame] {
+        write_image(frame.path, target, image_format_from_path(frame.path));
+      });
     }
+    if (writing.valid())
+      writing.get();
+  }
+
+  // Mean of passes [first_pass, first_pass + passes) of the scene's camera over
+  // one block of the image, rows [i0, i1) counted from the bottom and columns
+  // [j0, j1), into target at the block's size. i0 and j0 are multiples of
+  // kTileSize, and so are i1 and j1 unless they are the image's edges. Every
+  // pixel gets the samples it gets in a full frame, so blocks rendered apart,
+  // on other machines even, put together the same image.
+  void RenderRegion(const Scene &scene, int i0, int i1, int j0, int j1,
+                    int first_pass, int passes, FrameBuffer &target) {
+    if (i0 < 0 || j0 < 0 || i0 % kTileSize || j0 % kTileSize || i0 >= i1 ||
+        j0 >= j1 ||
+        (i1 % kTileSize && i1 != scene.height) ||
+        (j1 % kTileSize && j1 != scene.width) || i1 > scene.height ||
+        j1 > scene.width)
+      throw "renderer error:region not on the tile grid";
+    target.resize(j1 - j0, i1 - i0, layout);
+    begin_frame(scene);
+    const int tiles_x = (scene.width + kTileSize - 1) / kTileSize;
+    const int rows = (i1 - i0 + kTileSize - 1) / kTileSize;
+    const int columns = (j1 - j0 + kTileSize - 1) / kTileSize;
+    uint32_t *tiles = arena.Allocate<uint32_t>((size_t)rows * columns);
+    for (int r = 0; r < rows; ++r)
+      for (int c = 0; c < columns; ++c)
+        tiles[r * columns + c] = (i0 / kTileSize + r) * tiles_x + j0 / kTileSize + c;
+    render_mean(scene, scene.camera, first_pass, passes, target,
+                ArrayView<uint32_t>(tiles, (size_t)rows * columns), j0,
+                scene.height - i1);
+    end_stats();
+  }
+
+  // Renders up to settings.max_samples passes of one jittered sample per pixel
+  // (the first one at the pixel centers, as Render() does) and keeps their mean
+  // in the frame buffer. Stops early on the time budget or once every pixel has
+  // converged; the final image is written as by Render(). With
+  // settings.adaptive a pass only samples the tiles that have not converged.
+  ProgressiveStats RenderProgressive(const Scene &scene,
+                                     const ProgressiveSettings &settings) {
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    frame_buffer.resize(scene.width, scene.height, layout);
+    sample_buffer.resize(scene.width, scene.height, layout);
+    accumulation.resize(scene.width, scene.height, layout);
+    accumulation.clear();
+    begin_frame(scene);
+    const bool adaptive = settings.adaptive && settings.convergence_threshold > 0;
+    const size_t tiles = num_tiles(scene);
+    uint32_t *active = arena.Allocate<uint32_t>(tiles);
+    size_t num_active = tiles;
+    for (size_t t = 0; t < tiles; ++t)
+      active[t] = t;
+    // per tile, kept for the tiles that leave the active list
+    int *tile_converged = arena.Allocate<int>(tiles);
+    int *tile_pixels = arena.Allocate<int>(tiles);
+
+    ProgressiveStats stats;
+    while (stats.samples < settings.max_samples && num_active > 0) {
+      render_samples(scene, scene.camera, stats.samples, sample_buffer,
+                     ArrayView<uint32_t>(active, num_active));
+      const int n = ++stats.samples;
+      pool.parallel_for(num_active, [&](size_t k, unsigned) {
+        const uint32_t tile = active[k];
+        int i0, i1, j0, j1;
+        tile_rect(scene, tile, i0, i1, j0, j1);
+        int converged = 0;
+        for (int i = i0; i < i1; ++i) {
+          const int y = scene.height - 1 - i;
+          for (int x = j0; x < j1; ++x) {
+            const Vector3f &sample = sample_buffer.at(x, y);
+            PixelStats &acc = accumulation.at(x, y);
+            const float lum = luminance(sample);
+            acc.sum += sample;
+            acc.sum_lum += lum;
+            acc.sum_lum2 += lum * lum;
+            ++acc.samples;
+            frame_buffer.at(x, y) = acc.sum / acc.samples;
+            converged += is_converged(acc, acc.samples, settings.convergence_threshold);
+          }
+        }
+        tile_converged[tile] = converged;
+        tile_pixels[tile] = (i1 - i0) * (j1 - j0);
+      });
+      for (size_t k = 0; k < num_active; ++k)
+        stats.camera_samples += tile_pixels[active[k]];
+      stats.converged_pixels = 0;
+      for (size_t t = 0; t < tiles; ++t)
+        stats.converged_pixels += tile_converged[t];
+      stats.seconds =
+          std::chrono::duration<double>(clock::now() - start).count();
+      if (adaptive)
+        num_active = std::remove_if(active, active + num_active,
+                                    [&](uint32_t tile) {
+                                      return tile_converged[tile] == tile_pixels[tile];
+                                    }) -
+                     active;
+
+      if (settings.output_interval > 0 && n % settings.output_interval == 0 &&
+          n < settings.max_samples) {
+        if (settings.on_progress)
+          settings.on_progress(frame_buffer, stats);
+        else
+          write_image(output_path, frame_buffer, output_format);
+      }
+      if (settings.convergence_threshold > 0 &&
+          stats.converged_pixels == (size_t)scene.width * scene.height)
+        break;
+      // stop when the next pass, at the mean pass time, would go over budget
+      if (settings.time_budget > 0 &&
+          stats.seconds * (n + 1) / n > settings.time_budget)
+        break;
     }
+    end_stats();
+    write_image(output_path, frame_buffer, output_format);
+    return stats;
   }
 
-  return hitColor;
-}
+  [[nodiscard]] unsigned get_num_threads() const { return pool.size(); }
 
-class Renderer {
-public:
-  void Render(const Scene &scene) {
-    std::vector<std::vector<Vector3f>> frame_buffer(scene.height,std::vector<Vector3f>(scene.width));
-    Vector3f eye_pos(0);
-    float focal_length=1.0;
-    float viewport_height=std::tan(deg2rad(scene.fov * 0.5f))*focal_length;
-    float viewport_width=viewport_height*scene.width / (float)scene.height;
-    for(int i=0;i<frame_buffer.size();++i){
-      for(int j=0;j<frame_buffer[0].size();++j){
-            float ndc_x = (j + 0.5f) /scene.width *2 - 1.0f;
-            float ndc_y = (i + 0.5f) /scene.height*2 - 1.0f;
-            float y = ndc_y * viewport_height;
-            float x = ndc_x * viewport_width;
-            Vector3f dir = normalize(Vector3f(x, y, -1)); 
-            frame_buffer[i][j] = 255*castRay(eye_pos, dir, scene, 0);
+  void set_render_mode(RenderMode m) { mode = m; }
+
+  // where the progressive passes after the first place their samples
+  void set_sampler(SamplerType type) {
+    samplers.clear();
+    for (unsigned w = 0; w < pool.size(); ++w)
+      samplers.push_back(make_sampler(type));
+  }
+
+  // trace primary rays as 2x2 packets (default) instead of one by one
+  void set_packet_tracing(bool enabled) { packet_tracing = enabled; }
+
+  // Tiled keeps each 8x8 block on its own cache lines; takes effect next frame
+  void set_pixel_layout(PixelLayout l) { layout = l; }
+  // last rendered frame, reused (not reallocated) by the next Render()
+  [[nodiscard]] const FrameBuffer &get_frame_buffer() const { return frame_buffer; }
+
+  void set_output(const std::string &path, ImageFormat format) {
+    output_path = path;
+    output_format = format;
+  }
+  void set_output(const std::string &path) {
+    set_output(path, image_format_from_path(path));
+  }
+
+#ifdef RT_STATS
+  // counters and tile times of the last Render() or RenderProgressive()
+  [[nodiscard]] const FrameStats &get_frame_stats() const { return frame_stats; }
+
+  // Work per pixel (primitive tests and BVH node visits) of the last frame on a
+  // log scale, black to blue, red, yellow and white at the costliest pixel. Tile
+  // mode only; the wavefront integrator does not attribute work to pixels.
+  void write_cost_heatmap(const std::string &path) const {
+    float max_cost = 0;
+    for (int y = 0; y < pixel_cost.get_height(); ++y)
+      for (int x = 0; x < pixel_cost.get_width(); ++x)
+        max_cost = std::max(max_cost, pixel_cost.at(x, y));
+    const Vector3f ramp[] = {Vector3f(0), Vector3f(0, 0, 1), Vector3f(1, 0, 0),
+                             Vector3f(1, 1, 0), Vector3f(1)};
+    FrameBuffer image(pixel_cost.get_width(), pixel_cost.get_height());
+    for (int y = 0; y < image.get_height(); ++y)
+      for (int x = 0; x < image.get_width(); ++x) {
+        const float t =
+            max_cost > 0 ? std::log1p(pixel_cost.at(x, y)) / std::log1p(max_cost) * 4 : 0;
+        const int k = std::min((int)t, 3);
+        image.at(x, y) = lerp(ramp[k], ramp[k + 1], t - k);
       }
-    }    
-    const std::string path="binary.ppm";
-    write_ppm_header(path, frame_buffer.size(), frame_buffer[0].size());
-    write_ppm_data(path, frame_buffer);
+    write_image(path, image, image_format_from_path(path));
   }
+#endif
 
 private:
-  void write_ppm_header(std::string path, int width,int height){
-    std::ofstream file;
+  struct PixelStats {
+    Vector3f sum;
+    float sum_lum = 0, sum_lum2 = 0;
+    int samples = 0;
+  };
+
+  static float luminance(const Vector3f &c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+  }
+
+  // standard error of the mean luminance within threshold of the mean
+  static bool is_converged(const PixelStats &acc, int n, float threshold) {
+    if (threshold <= 0 || n < ProgressiveSettings::kMinSamples)
+      return false;
+    const float mean = acc.sum_lum / n;
+    const float variance =
+        std::max(0.f, (acc.sum_lum2 - n * mean * mean) / (n - 1));
+    return std::sqrt(variance / n) <=
+           threshold * std::max(mean, ProgressiveSettings::kMinLuminance);
+  }
+
+  // Sample offset in the pixel for pass: the center for pass 0, then sample
+  // pass - 1 of the worker's sampler. The lens point comes next in the sample
+  // and is the lens center for pass 0; it is only drawn when lens is given.
+  Vector2f jitter(int i, int j, int pass, unsigned worker,
+                  Vector2f *lens = nullptr) const {
+    if (pass == 0) {
+      if (lens)
+        *lens = Vector2f(0.5f, 0.5f);
+      return Vector2f(0.5f, 0.5f);
+    }
+    Sampler &sampler = *samplers[worker];
+    sampler.start_pixel(j, i, pass - 1);
+    const Vector2f pixel = sampler.get_2d();
+    if (lens)
+      *lens = sampler.get_2d();
+    return pixel;
+  }
+
+  // Starts a frame: releases the scratch of the last one, and with RT_STATS
+  // starts counting, see FrameStats. Reuses the stats' memory.
+  void begin_frame(const Scene &scene) {
+    arena.Reset();
+    if constexpr (kStatsEnabled) {
+      stats_reset();
+      std::fill(std::begin(frame_stats.counters), std::end(frame_stats.counters), 0);
+      frame_stats.seconds = 0;
+      frame_stats.tiles.resize(num_tiles(scene));
+      for (size_t t = 0; t < frame_stats.tiles.size(); ++t)
+        frame_stats.tiles[t] = {(uint32_t)t, 0, 0};
+      pixel_cost.resize(scene.width, scene.height);
+      pixel_cost.clear();
+      stats_start = std::chrono::steady_clock::now();
+    }
+  }
 
-    file.open(path,std::ios::out);
-    if(!file.is_open()){
-      throw "write header error:file cannot open";
+  void end_stats() {
+    if constexpr (kStatsEnabled) {
+      stats_collect(frame_stats.counters);
+      frame_stats.seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - stats_start)
+                                .count();
     }
-    file<<"P6\n";
-    file<<height<<" "<<width<<'\n';
-    file<<255<<'\n';
-  }
-  void write_ppm_data(std::string path, const std::vector<std::vector<Vector3f>>& frame_buffer){
-    std::ofstream file;
-    file.open(path,std::ios::app);
-    if(!file.is_open()){
-      throw "write header error:file cannot open";
+  }
+
+  // work of the pixel at (x, y) of the frame, for the cost heatmap
+  void add_cost(int x, int y, float work) {
+    if constexpr (kStatsEnabled)
+      pixel_cost.at(x, y) += work;
+  }
+
+  // mean of passes [first_pass, first_pass + passes) into target, see
+  // render_samples() for tiles and the target's origin
+  void render_mean(const Scene &scene, const Camera &camera, int first_pass,
+                   int passes, FrameBuffer &target,
+                   ArrayView<uint32_t> tiles = {}, int x0 = 0, int y0 = 0) {
+    render_samples(scene, camera, first_pass, target, tiles, x0, y0);
+    if (passes <= 1)
+      return;
+    sample_buffer.resize(target.get_width(), target.get_height(), layout);
+    for (int pass = first_pass + 1; pass < first_pass + passes; ++pass) {
+      render_samples(scene, camera, pass, sample_buffer, tiles, x0, y0);
+      pool.parallel_for(target.get_height(), [&](size_t y, unsigned) {
+        for (int x = 0; x < target.get_width(); ++x)
+          target.at(x, y) += sample_buffer.at(x, y);
+      });
     }
-    for(int i=frame_buffer.size()-1;i>=0;--i){
-      for(int j=0;j<frame_buffer[0].size();++j){
-         file<<(char)frame_buffer[i][j].x <<(char)frame_buffer[i][j].y<<(char)frame_buffer[i][j].z;
+    const float scale = 1.f / passes;
+    pool.parallel_for(target.get_height(), [&](size_t y, unsigned) {
+      for (int x = 0; x < target.get_width(); ++x)
+        target.at(x, y) = target.at(x, y) * scale;
+    });
+  }
+
+  static int num_tiles(const Scene &scene) {
+    const int tiles_x = (scene.width + kTileSize - 1) / kTileSize;
+    const int tiles_y = (scene.height + kTileSize - 1) / kTileSize;
+    return tiles_x * tiles_y;
+  }
+
+  // rows [i0, i1) counted from the bottom and columns [j0, j1) of tile
+  static void tile_rect(const Scene &scene, uint32_t tile, int &i0, int &i1,
+                        int &j0, int &j1) {
+    const int tiles_x = (scene.width + kTileSize - 1) / kTileSize;
+    i0 = tile / tiles_x * kTileSize;
+    j0 = tile % tiles_x * kTileSize;
+    i1 = std::min(i0 + kTileSize, scene.height);
+    j1 = std::min(j0 + kTileSize, scene.width);
+  }
+
+  // One sample per pixel for pass, seen from camera, into target, which has the
+  // scene's size. Non-empty tiles restrict it to those tiles; the rest of target
+  // is left undefined. A target holding only a block of the image has the
+  // block's top left pixel at (x0, y0) of the frame.
+  void render_samples(const Scene &scene, const Camera &camera, int pass,
+                      FrameBuffer &target, ArrayView<uint32_t> tiles = {},
+                      int x0 = 0, int y0 = 0) {
+    float viewport_height = std::tan(deg2rad(camera.fov * 0.5f));
+    float viewport_width=viewport_height*scene.width / (float)scene.height;
+    const size_t count = tiles.empty() ? num_tiles(scene) : tiles.size();
+    auto tile_of = [&](size_t k) { return tiles.empty() ? (uint32_t)k : tiles[k]; };
+    const bool thin_lens = camera.aperture > 0;
+    auto primary_ray = [&](int i, int j, unsigned worker, Vector3f &orig,
+                           Vector3f &dir) {
+      Vector2f lens;
+      const Vector2f d = jitter(i, j, pass, worker, thin_lens ? &lens : nullptr);
+      float ndc_x = (j + d.x) /scene.width *2 - 1.0f;
+      float ndc_y = (i + d.y) /scene.height*2 - 1.0f;
+      float y = ndc_y * viewport_height;
+      float x = ndc_x * viewport_width;
+      camera.GenerateRay(x, y, lens, orig, dir);
+    };
+    if (mode == RenderMode::Wavefront) {
+      // camera rays tile by tile; a pixel's rays keep their queue order, so
+      // the image does not depend on the order of the tiles
+      Arena::Scope scratch(arena);
+      size_t *first = arena.Allocate<size_t>(count + 1);
+      for (size_t k = 0; k < count; ++k) {
+        int i0, i1, j0, j1;
+        tile_rect(scene, tile_of(k), i0, i1, j0, j1);
+        first[k + 1] = first[k] + (size_t)(i1 - i0) * (j1 - j0);
       }
+      std::vector<WavefrontRay> &rays = wavefront.camera_rays();
+      rays.resize(first[count]);
+      pool.parallel_for(count, [&](size_t k, unsigned worker) {
+        int i0, i1, j0, j1;
+        tile_rect(scene, tile_of(k), i0, i1, j0, j1);
+        size_t r = first[k];
+        for (int i = i0; i < i1; ++i) {
+          const uint32_t row = scene.height - 1 - i - y0;
+          for (int j = j0; j < j1; ++j) {
+            WavefrontRay &ray = rays[r++];
+            ray = {Vector3f(), Vector3f(), 1.f,
+                   (uint32_t)(row * target.get_width() + j - x0), 0};
+            primary_ray(i, j, worker, ray.orig, ray.dir);
+          }
+        }
+      });
+      RT_STAT_ADD(PrimaryRays, rays.size());
+      target.clear();
+      wavefront.render(scene, pool, target);
+      return;
     }
+    pool.parallel_for(count, [&](size_t k, unsigned worker) {
+      int i0, i1, j0, j1;
+      tile_rect(scene, tile_of(k), i0, i1, j0, j1);
+      TileTimer timer(frame_stats, tile_of(k));
+      if (!packet_tracing) {
+        for(int i=i0;i<i1;++i){
+          for(int j=j0;j<j1;++j){
+            const uint64_t work = stat_work();
+            RT_STAT(PrimaryRays);
+            Vector3f orig, dir;
+            primary_ray(i, j, worker, orig, dir);
+            target.at(j - x0, scene.height - 1 - i - y0) = castRay(orig, dir, scene, 0);
+            add_cost(j, scene.height - 1 - i, float(stat_work() - work));
+          }
+        }
+        return;
+      }
+      // 2x2 pixel quads share one primary ray packet; secondary rays stay scalar
+      for(int i=i0;i<i1;i+=2){
+        for(int j=j0;j<j1;j+=2){
+          Vector3f orig[4], dir[4];
+          int active = 0;
+          for (int k = 0; k < RayPacket4::kSize; ++k) {
+            const int pi = std::min(i + k / 2, i1 - 1), pj = std::min(j + k % 2, j1 - 1);
+            primary_ray(pi, pj, worker, orig[k], dir[k]);
+            if (i + k / 2 < i1 && j + k % 2 < j1)
+              active |= 1 << k;
+          }
+          hit_payload payload[4];
+          RT_STAT_ADD(PrimaryRays, count_lanes(active));
+          const uint64_t packet_work = stat_work();
+          const int hits = scene.maxDepth < 0 ? 0 : tracePacket(RayPacket4(orig, dir), active, scene, payload);
+          // the packet's work is shared evenly by its pixels
+          const float shared_work = float(stat_work() - packet_work) / count_lanes(active);
+          for (int k = 0; k < RayPacket4::kSize; ++k) {
+            if (!(active & (1 << k)))
+              continue;
+            const uint64_t work = stat_work();
+            Vector3f color;
+            if (scene.maxDepth >= 0)
+              color = integrate(orig[k], dir[k], hits & (1 << k) ? &payload[k] : nullptr,
+                                scene, 0);
+            target.at(j + k % 2 - x0, scene.height - 1 - (i + k / 2) - y0) = color;
+            add_cost(j + k % 2, scene.height - 1 - (i + k / 2), shared_work + float(stat_work() - work));
+          }
+        }
+      }
+    });
   }
+
+  ThreadPool pool;
+  FrameBuffer frame_buffer;
+  // per pass sample and running sums of RenderProgressive()
+  FrameBuffer sample_buffer;
+  PixelBuffer<PixelStats> accumulation;
+  PixelLayout layout = PixelLayout::Linear;
+  // only filled in RT_STATS builds
+  FrameStats frame_stats;
+  PixelBuffer<float> pixel_cost;
+  std::chrono::steady_clock::time_point stats_start;
+  bool packet_tracing = true;
+  // one per worker, used by the passes after the first
+  std::vector<std::unique_ptr<Sampler>> samplers;
+  // Scratch data of the current frame. Only the calling thread allocates from
+  // it, before handing the workers their tasks; they only read the results.
+  Arena arena;
+  RenderMode mode = RenderMode::Tile;
+  WavefrontIntegrator wavefront;
+  std::string output_path = "binary.ppm";
+  ImageFormat output_format = ImageFormat::PPM;
 };
@@ -0,0 +1,159 @@
+#pragma once
+#include "Vector.hpp"
+#include "global.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+// Produces the values of one pixel sample, one dimension at a time: after
+// start_pixel() the calls to get_1d() and get_2d() walk through the sample's
+// dimensions. The values depend only on the pixel, the sample index and the
+// dimension, so a pixel renders the same on any thread and in any order.
+class Sampler {
+public:
+  virtual ~Sampler() = default;
+
+  virtual void start_pixel(int x, int y, uint32_t index) = 0;
+  virtual float get_1d() = 0;
+  virtual Vector2f get_2d() {
+    const float u = get_1d();
+    return Vector2f(u, get_1d());
+  }
+};
+
+namespace sampler_detail {
+
+inline uint32_t pixel_seed(int x, int y) { return hash_u32(x + hash_u32(y)); }
+
+inline float to_float(uint32_t bits) { return (bits >> 8) * (1.f / 16777216.f); }
+
+inline uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// Owen scrambling of the bits of x from the top down, hashed as in Burley,
+// "Practical Hash-based Owen Scrambling" (JCGT 2020). A bijection on uint32.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+// first two dimensions of the Sobol sequence, a (0, 2)-sequence in base 2
+inline uint32_t sobol0(uint32_t index) { return reverse_bits(index); }
+inline uint32_t sobol1(uint32_t index) {
+  uint32_t x = 0;
+  for (uint32_t v = 0x80000000u; index; index >>= 1, v ^= v >> 1)
+    if (index & 1)
+      x ^= v;
+  return x;
+}
+
+constexpr int kHaltonDimensions = 16;
+constexpr uint32_t kPrimes[kHaltonDimensions] = {2,  3,  5,  7,  11, 13, 17, 19,
+                                                 23, 29, 31, 37, 41, 43, 47, 53};
+
+inline float radical_inverse(uint32_t base, uint32_t index) {
+  const float inv_base = 1.f / base;
+  float inv = inv_base, value = 0;
+  for (; index; index /= base, inv *= inv_base)
+    value += (index % base) * inv;
+  return std::min(value, 0x1.fffffep-1f);
+}
+
+} // namespace sampler_detail
+
+// Pseudo-random values from a Pcg32 seeded by pixel and sample index.
+class IndependentSampler : public Sampler {
+public:
+  void start_pixel(int x, int y, uint32_t index) override {
+    const uint32_t pixel = sampler_detail::pixel_seed(x, y);
+    rng.set_sequence(((uint64_t)hash_u32(pixel ^ index) << 32) | index, pixel);
+  }
+  float get_1d() override { return rng.next_float(); }
+
+private:
+  Pcg32 rng;
+};
+
+// Halton sequence over the sample indices, one prime base per dimension, with
+// a per pixel random shift (Cranley-Patterson rotation) so that pixels do not
+// repeat one pattern. Dimensions past the prime table are pseudo-random.
+class HaltonSampler : public Sampler {
+public:
+  void start_pixel(int x, int y, uint32_t i) override {
+    pixel = sampler_detail::pixel_seed(x, y);
+    index = i;
+    dimension = 0;
+    rng.set_sequence(((uint64_t)hash_u32(pixel ^ index) << 32) | index, pixel);
+  }
+  float get_1d() override {
+    using namespace sampler_detail;
+    if (dimension >= kHaltonDimensions)
+      return rng.next_float();
+    float value = radical_inverse(kPrimes[dimension], index) +
+                  hash_float(pixel + hash_u32(dimension));
+    ++dimension;
+    if (value >= 1)
+      value -= 1;
+    return std::min(value, 0x1.fffffep-1f);
+  }
+
+private:
+  Pcg32 rng;
+  uint32_t pixel = 0, index = 0;
+  int dimension = 0;
+};
+
+// Owen-scrambled Sobol points: every get_2d() pair is the 2D Sobol sequence and
+// every get_1d() its first dimension, each with its own scramble per pixel and
+// its own shuffle of the sample indices, so dimensions are not correlated.
+// Stratified best for power of two sample counts.
+class SobolSampler : public Sampler {
+public:
+  void start_pixel(int x, int y, uint32_t i) override {
+    pixel = sampler_detail::pixel_seed(x, y);
+    index = i;
+    dimension = 0;
+  }
+  float get_1d() override {
+    using namespace sampler_detail;
+    const uint32_t seed = next_seed();
+    const uint32_t shuffled = owen_scramble(index, seed);
+    return to_float(owen_scramble(sobol0(shuffled), hash_u32(seed ^ 1)));
+  }
+  Vector2f get_2d() override {
+    using namespace sampler_detail;
+    const uint32_t seed = next_seed();
+    const uint32_t shuffled = owen_scramble(index, seed);
+    return Vector2f(to_float(owen_scramble(sobol0(shuffled), hash_u32(seed ^ 1))),
+                    to_float(owen_scramble(sobol1(shuffled), hash_u32(seed ^ 2))));
+  }
+
+private:
+  uint32_t next_seed() { return hash_u32(pixel + hash_u32(dimension++)); }
+
+  uint32_t pixel = 0, index = 0, dimension = 0;
+};
+
+enum class SamplerType { Independent, Halton, Sobol };
+
+inline std::unique_ptr<Sampler> make_sampler(SamplerType type) {
+  switch (type) {
+  case SamplerType::Independent:
+    return std::make_unique<IndependentSampler>();
+  case SamplerType::Halton:
+    return std::make_unique<HaltonSampler>();
+  default:
+    return std::make_unique<SobolSampler>();
+  }
+}
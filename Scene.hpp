@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include "Vector.hpp"
+#include "Camera.hpp"
 #include "Object.hpp"
 #include "Light.hpp"
+#include "Material.hpp"
+#include "CompiledScene.hpp"
+#include "LightTree.hpp"
 
 class Scene
 {
@@ -12,22 +17,125 @@ public:
     // setting up options
     int width = 1280;
     int height = 960;
-    double fov = 90;
+    Camera camera;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
     int maxDepth = 5;
+    // reflection/refraction branches weighted below this are not traced
+    float minContribution = 1e-3f;
     float epsilon = 0.00001;
+    // Diffuse hits reached by more lights than this shade an unbiased sample of
+    // about this many, picked by intensity; 0 shades every light. Needs
+    // compile(), and scenes of one or two lights are always shaded in full.
+    int lightSamples = 0;
 
-    Scene(int w, int h) : width(w), height(h)
+    Scene(int w, int h) : width(w), height(h), materials(1), materialFactors(1, MaterialFactors(Material()))
     {}
 
-    void Add(std::unique_ptr<Object> object) { objects.push_back(std::move(object)); }
-    void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
+    // after compile() the object joins the compiled scene in place on the next Update()
+    void Add(std::unique_ptr<Object> object)
+    {
+        if (compiled)
+            added.push_back(object.get());
+        objects.push_back(std::move(object));
+    }
+    // deletes object, dropping it from the compiled scene in place
+    void Remove(const Object* object)
+    {
+        auto it = std::find_if(objects.begin(), objects.end(), [&](const auto& o) { return o.get() == object; });
+        if (it == objects.end())
+            throw "scene error:no such object";
+        if (compiled)
+            compiled->Remove(object);
+        changed.erase(std::remove(changed.begin(), changed.end(), object), changed.end());
+        added.erase(std::remove(added.begin(), added.end(), object), added.end());
+        objects.erase(it);
+    }
+    // after compile() the light index is rebuilt at once, so the light is shaded
+    void Add(std::unique_ptr<Light> light)
+    {
+        lights.push_back(std::move(light));
+        if (lightTree)
+            compile_lights();
+    }
+
+    // id of material in the material table; equal materials share one entry
+    MaterialId AddMaterial(const Material& material)
+    {
+        for (MaterialId id = 0; id < materials.size(); ++id)
+            if (materials[id] == material)
+                return id;
+        materials.push_back(material);
+        materialFactors.emplace_back(material);
+        return materials.size() - 1;
+    }
+
+    // replaces material id for every object using it; takes effect on the next render
+    void SetMaterial(MaterialId id, const Material& material)
+    {
+        if (id >= materials.size())
+            throw "scene error:no such material";
+        materials[id] = material;
+        materialFactors[id] = MaterialFactors(material);
+    }
 
     [[nodiscard]] const std::vector<std::unique_ptr<Object> >& get_objects() const { return objects; }
     [[nodiscard]] const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
+    // lights stay editable in place; call compile_lights() after moving one
+    [[nodiscard]] Light& get_light(size_t index) { return *lights[index]; }
+    [[nodiscard]] const std::vector<Material>& get_materials() const { return materials; }
+    [[nodiscard]] const Material& get_material(MaterialId id) const { return materials[id]; }
+    [[nodiscard]] const MaterialFactors& get_material_factors(MaterialId id) const { return materialFactors[id]; }
+    // nullptr until compile() is called, trace() then falls back to a linear scan
+    [[nodiscard]] const CompiledScene* get_compiled() const { return compiled.get(); }
+    // nullptr until compile() is called, shading then loops over every light
+    [[nodiscard]] const LightTree* get_light_tree() const { return lightTree.get(); }
+
+    // (re)build the render-time form of the objects and lights, call after the last Add()
+    void compile()
+    {
+        added.clear();
+        compiled = std::make_unique<CompiledScene>(objects);
+        compile_lights();
+    }
+    // Animation: pass every object moved since the last frame (a Sphere's center,
+    // MeshTriangle::SetVertex(), SphereGroup::SetSphere(),
+    // MeshInstance::SetTransform()), then call Update(). It refits the meshes'
+    // and sphere groups' BVHs and the scene BVH bottom up instead of
+    // rebuilding them, and rebuilds only the subtrees whose SAH cost degraded
+    // past rebuildThreshold times their built cost. A mesh shared by instances
+    // is not a scene object: whoever edits it calls its Refit() and marks the
+    // instances.
+    void MarkChanged(Object* object) { changed.push_back(object); }
+    void Update(float rebuildThreshold = 1.5f)
+    {
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        for (Object* object : changed)
+            if (auto* mesh = dynamic_cast<MeshTriangle*>(object))
+                mesh->Refit(rebuildThreshold);
+            else if (auto* spheres = dynamic_cast<SphereGroup*>(object))
+                spheres->Refit(rebuildThreshold);
+        if (compiled)
+        {
+            compiled->Insert(added);
+            compiled->Refit(changed, rebuildThreshold);
+        }
+        changed.clear();
+        added.clear();
+    }
+
+    // rebuild only the light index, after the lights changed but the objects did not
+    void compile_lights() { lightTree = std::make_unique<LightTree>(lights); }
 
 private:
     // creating the scene (adding objects and lights)
     std::vector<std::unique_ptr<Object> > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    std::vector<Material> materials;
+    std::vector<MaterialFactors> materialFactors; // one per material
+    std::unique_ptr<CompiledScene> compiled;
+    std::unique_ptr<LightTree> lightTree;
+    // since the last Update()
+    std::vector<Object*> changed;
+    std::vector<Object*> added;
 };
\ No newline at end of file
@@ -0,0 +1,317 @@
+#pragma once
+
+#include "Instance.hpp"
+#include "MappedFile.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Binary scene cache. The file holds the materials, lights and objects of a
+// Scene, and for every mesh its vertex, index and st arrays together with its
+// prebuilt BVH. Those arrays are stored in their in-memory layout at 64-byte
+// aligned offsets, so load_scene_cache() maps the file and the meshes use them in
+// place: loading costs no parsing, copying or BVH building. The layout depends
+// on the build (RT_SIMD changes sizeof(Vector3f)) and the byte order, and caches
+// written by a different build are rejected.
+namespace cache_detail {
+
+constexpr char kMagic[4] = {'R', 'T', 'S', 'C'};
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kByteOrder = 0x01020304;
+constexpr uint64_t kAlign = 64;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  // sizes of the types stored in place, checked against the loading build
+  uint32_t vector3_size, vector2_size, node_size;
+  uint32_t num_materials, num_lights, num_objects, num_meshes;
+  // byte offsets of the record tables
+  uint64_t materials, lights, objects, meshes;
+};
+
+struct MaterialRecord {
+  uint32_t type;
+  float ior, Kd, Ks;
+  float diffuse_color[3];
+  float specular_exponent;
+};
+
+struct LightRecord {
+  float position[3];
+  float intensity[3];
+  float radius;
+};
+
+enum ObjectKind : uint32_t { kSphere, kMesh, kInstance };
+
+struct ObjectRecord {
+  uint32_t kind;
+  uint32_t mesh; // kMesh, kInstance: index into the mesh table
+  uint32_t material;
+  uint32_t pad;
+  // kSphere: center, radius; kInstance: 3x4 object to world matrix
+  float data[12];
+};
+
+struct MeshRecord {
+  uint32_t num_vertices, num_triangles, num_nodes;
+  uint32_t storage; // TriangleStorage
+  uint64_t vertices, indices, st, nodes, prim_indices;
+};
+
+// Appends to a file, padding every block to kAlign.
+class Writer {
+public:
+  explicit Writer(const std::string &path)
+      : file(std::fopen(path.c_str(), "wb")) {
+    if (!file) {
+      throw "scene cache error:file cannot open";
+    }
+  }
+  ~Writer() {
+    if (file)
+      std::fclose(file);
+  }
+
+  // writes n bytes at the next aligned offset and returns that offset
+  uint64_t write(const void *data, size_t n) {
+    static const char zeros[kAlign] = {};
+    const uint64_t start = (offset + kAlign - 1) / kAlign * kAlign;
+    put(zeros, start - offset);
+    put(data, n);
+    return start;
+  }
+
+  template <typename T> uint64_t write(const std::vector<T> &v) {
+    return write(v.data(), v.size() * sizeof(T));
+  }
+
+  // overwrites the start of the file with the header and closes it
+  void finish(const Header &header) {
+    if (std::fseek(file, 0, SEEK_SET) != 0 ||
+        std::fwrite(&header, sizeof(header), 1, file) != 1) {
+      throw "scene cache error:short write";
+    }
+    FILE *f = file;
+    file = nullptr;
+    if (std::fclose(f) != 0) {
+      throw "scene cache error:short write";
+    }
+  }
+
+private:
+  void put(const void *data, size_t n) {
+    if (n && std::fwrite(data, 1, n, file) != n) {
+      throw "scene cache error:short write";
+    }
+    offset += n;
+  }
+
+  FILE *file;
+  uint64_t offset = 0;
+};
+
+} // namespace cache_detail
+
+// Writes the materials, lights and objects of scene. Spheres, meshes and mesh
+// instances are supported; meshes shared by several instances are stored once.
+inline void write_scene_cache(const std::string &path, const Scene &scene) {
+  using namespace cache_detail;
+  Writer out(path);
+  Header header = {};
+  out.write(&header, sizeof(header)); // placeholder, see finish()
+
+  std::vector<MaterialRecord> materials;
+  for (const Material &m : scene.get_materials())
+    materials.push_back({(uint32_t)m.materialType, m.ior, m.Kd, m.Ks,
+                         {m.diffuseColor.x, m.diffuseColor.y, m.diffuseColor.z},
+                         m.specularExponent});
+  std::vector<LightRecord> lights;
+  for (const auto &light : scene.get_lights())
+    lights.push_back({{light->position.x, light->position.y, light->position.z},
+                      {light->intensity.x, light->intensity.y, light->intensity.z},
+                      light->radius});
+
+  std::vector<ObjectRecord> objects;
+  std::vector<MeshRecord> meshes;
+  std::unordered_map<const MeshTriangle *, uint32_t> mesh_ids;
+  auto add_mesh = [&](const MeshTriangle &mesh) {
+    auto [it, inserted] = mesh_ids.emplace(&mesh, meshes.size());
+    if (!inserted)
+      return it->second;
+    MeshRecord r = {};
+    r.num_vertices = mesh.numVertices;
+    r.num_triangles = mesh.numTriangles;
+    r.num_nodes = mesh.bvh.get_nodes().size();
+    r.storage = (uint32_t)mesh.get_storage();
+    r.vertices = out.write(mesh.vertices, sizeof(Vector3f) * mesh.numVertices);
+    r.indices = out.write(mesh.vertexIndex, sizeof(uint32_t) * 3 * mesh.numTriangles);
+    r.st = out.write(mesh.stCoordinates, sizeof(Vector2f) * mesh.numVertices);
+    r.nodes = out.write(mesh.bvh.get_nodes().data(), sizeof(LinearBVHNode) * r.num_nodes);
+    r.prim_indices = out.write(mesh.bvh.get_prim_indices().data(),
+                               sizeof(uint32_t) * mesh.bvh.get_prim_indices().size());
+    meshes.push_back(r);
+    return it->second;
+  };
+  for (const auto &object : scene.get_objects()) {
+    ObjectRecord r = {};
+    r.material = object->materialId;
+    if (auto *sphere = dynamic_cast<const Sphere *>(object.get())) {
+      r.kind = kSphere;
+      r.data[0] = sphere->center.x;
+      r.data[1] = sphere->center.y;
+      r.data[2] = sphere->center.z;
+      r.data[3] = sphere->radius;
+    } else if (auto *mesh = dynamic_cast<const MeshTriangle *>(object.get())) {
+      r.kind = kMesh;
+      r.mesh = add_mesh(*mesh);
+    } else if (auto *instance = dynamic_cast<const MeshInstance *>(object.get())) {
+      r.kind = kInstance;
+      r.mesh = add_mesh(*instance->get_mesh());
+      for (int i = 0; i < 12; ++i)
+        r.data[i] = instance->get_transform().get(i / 4, i % 4);
+    } else {
+      throw "scene cache error:unsupported object type";
+    }
+    objects.push_back(r);
+  }
+
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrder;
+  header.vector3_size = sizeof(Vector3f);
+  header.vector2_size = sizeof(Vector2f);
+  header.node_size = sizeof(LinearBVHNode);
+  header.num_materials = materials.size();
+  header.num_lights = lights.size();
+  header.num_objects = objects.size();
+  header.num_meshes = meshes.size();
+  header.materials = out.write(materials);
+  header.lights = out.write(lights);
+  header.objects = out.write(objects);
+  header.meshes = out.write(meshes);
+  out.finish(header);
+}
+
+// Maps the cache at path and adds its materials, lights and objects to scene.
+// Mesh data is used in place and the mapping lives as long as any mesh from it;
+// call scene.compile() afterwards as usual. Every index in the file, BVHs
+// included, is checked first, so a corrupt file throws instead of being read
+// out of bounds.
+inline void load_scene_cache(const std::string &path, Scene &scene) {
+  using namespace cache_detail;
+  auto file = std::make_shared<const MappedFile>(path);
+  const Header &header = *file->at<Header>(0, 1);
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    throw "scene cache error:not a scene cache";
+  }
+  if (header.byte_order != kByteOrder || header.vector3_size != sizeof(Vector3f) ||
+      header.vector2_size != sizeof(Vector2f) ||
+      header.node_size != sizeof(LinearBVHNode)) {
+    throw "scene cache error:written by an incompatible build";
+  }
+
+  const MaterialRecord *materials =
+      file->at<MaterialRecord>(header.materials, header.num_materials);
+  std::vector<MaterialId> material_ids(header.num_materials);
+  for (uint32_t i = 0; i < header.num_materials; ++i) {
+    const MaterialRecord &r = materials[i];
+    if (r.type > REFLECTION) {
+      throw "scene cache error:truncated or corrupt file";
+    }
+    Material m;
+    m.materialType = (MaterialType)r.type;
+    m.ior = r.ior;
+    m.Kd = r.Kd;
+    m.Ks = r.Ks;
+    m.diffuseColor = Vector3f(r.diffuse_color[0], r.diffuse_color[1], r.diffuse_color[2]);
+    m.specularExponent = r.specular_exponent;
+    material_ids[i] = scene.AddMaterial(m);
+  }
+
+  const LightRecord *lights = file->at<LightRecord>(header.lights, header.num_lights);
+  for (uint32_t i = 0; i < header.num_lights; ++i)
+    scene.Add(std::make_unique<Light>(
+        Vector3f(lights[i].position[0], lights[i].position[1], lights[i].position[2]),
+        Vector3f(lights[i].intensity[0], lights[i].intensity[1], lights[i].intensity[2]),
+        lights[i].radius));
+
+  const MeshRecord *meshes = file->at<MeshRecord>(header.meshes, header.num_meshes);
+  auto mesh_arrays = [&](uint32_t id) {
+    if (id >= header.num_meshes) {
+      throw "scene cache error:truncated or corrupt file";
+    }
+    const MeshRecord &r = meshes[id];
+    MeshArrays a;
+    a.vertices = file->at<Vector3f>(r.vertices, r.num_vertices);
+    a.vertexIndex = file->at<uint32_t>(r.indices, 3 * (uint64_t)r.num_triangles);
+    a.stCoordinates = file->at<Vector2f>(r.st, r.num_vertices);
+    a.numVertices = r.num_vertices;
+    a.numTriangles = r.num_triangles;
+    a.nodes = file->at<LinearBVHNode>(r.nodes, r.num_nodes);
+    a.numNodes = r.num_nodes;
+    a.primIndices = file->at<uint32_t>(r.prim_indices, r.num_triangles);
+    // the arrays are traversed unchecked once adopted, so check every index now
+    for (uint64_t i = 0; i < 3 * (uint64_t)r.num_triangles; ++i) {
+      if (a.vertexIndex[i] >= r.num_vertices) {
+        throw "scene cache error:truncated or corrupt file";
+      }
+    }
+    if (!BVH::IsValid(a.nodes, a.numNodes, a.primIndices, a.numTriangles)) {
+      throw "scene cache error:truncated or corrupt file";
+    }
+    return a;
+  };
+  auto mesh_storage = [&](uint32_t id) {
+    return meshes[id].storage == (uint32_t)TriangleStorage::Precomputed
+               ? TriangleStorage::Precomputed
+               : TriangleStorage::Indexed;
+  };
+
+  const ObjectRecord *objects = file->at<ObjectRecord>(header.objects, header.num_objects);
+  std::unordered_map<uint32_t, std::shared_ptr<const MeshTriangle>> shared_meshes;
+  for (uint32_t i = 0; i < header.num_objects; ++i) {
+    const ObjectRecord &r = objects[i];
+    if (r.material >= header.num_materials) {
+      throw "scene cache error:truncated or corrupt file";
+    }
+    std::unique_ptr<Object> object;
+    switch (r.kind) {
+    case kSphere:
+      object = std::make_unique<Sphere>(Vector3f(r.data[0], r.data[1], r.data[2]), r.data[3]);
+      break;
+    case kMesh: {
+      MeshArrays a = mesh_arrays(r.mesh);
+      object = std::make_unique<MeshTriangle>(a, file, mesh_storage(r.mesh));
+      break;
+    }
+    case kInstance: {
+      auto &mesh = shared_meshes[r.mesh];
+      if (!mesh) {
+        MeshArrays a = mesh_arrays(r.mesh);
+        mesh = std::make_shared<const MeshTriangle>(a, file, mesh_storage(r.mesh));
+      }
+      const float matrix[3][4] = {{r.data[0], r.data[1], r.data[2], r.data[3]},
+                                  {r.data[4], r.data[5], r.data[6], r.data[7]},
+                                  {r.data[8], r.data[9], r.data[10], r.data[11]}};
+      object = std::make_unique<MeshInstance>(mesh, Transform(matrix));
+      break;
+    }
+    default:
+      throw "scene cache error:truncated or corrupt file";
+    }
+    object->materialId = material_ids[r.material];
+    scene.Add(std::move(object));
+  }
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+// Thin 4-wide float vector over SSE or NEON. The backend is chosen at compile
+// time: defining RT_SIMD enables whichever the target supports, otherwise (or on
+// other targets) every operation falls back to plain scalar code with the same
+// results, so callers never need their own #ifdefs. min/max follow SSE: when a
+// lane compares false (NaN) the second operand is returned. float8 is the 8-wide
+// form: one AVX register when the target has AVX (e.g. with RT_NATIVE), else a
+// pair of float4.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(RT_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define RT_SIMD_SSE 1
+#include <immintrin.h>
+#elif defined(RT_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define RT_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(RT_SIMD_SSE) || defined(RT_SIMD_NEON)
+#define RT_SIMD_ENABLED 1
+#endif
+
+#if defined(RT_SIMD_SSE) && defined(__AVX__)
+#define RT_SIMD_AVX 1
+#endif
+
+// Lane mask produced by float4 comparisons.
+struct mask4
+{
+#if defined(RT_SIMD_SSE)
+    __m128 m;
+    mask4(__m128 mm) : m(mm) {}
+    static mask4 from_bits(int b)
+    {
+        return _mm_castsi128_ps(_mm_setr_epi32(-(b & 1), -((b >> 1) & 1), -((b >> 2) & 1), -((b >> 3) & 1)));
+    }
+    int bits() const { return _mm_movemask_ps(m); }
+    mask4 operator&(const mask4& o) const { return _mm_and_ps(m, o.m); }
+    mask4 operator|(const mask4& o) const { return _mm_or_ps(m, o.m); }
+#elif defined(RT_SIMD_NEON)
+    uint32x4_t m;
+    mask4(uint32x4_t mm) : m(mm) {}
+    static mask4 from_bits(int b)
+    {
+        const uint32x4_t bit = {1, 2, 4, 8};
+        return vtstq_u32(vdupq_n_u32(b), bit);
+    }
+    int bits() const
+    {
+        const int32x4_t shift = {0, 1, 2, 3};
+        return vaddvq_u32(vshlq_u32(vshrq_n_u32(m, 31), shift));
+    }
+    mask4 operator&(const mask4& o) const { return vandq_u32(m, o.m); }
+    mask4 operator|(const mask4& o) const { return vorrq_u32(m, o.m); }
+#else
+    bool m[4];
+    mask4(bool a, bool b, bool c, bool d) : m{a, b, c, d} {}
+    static mask4 from_bits(int b) { return {(b & 1) != 0, (b & 2) != 0, (b & 4) != 0, (b & 8) != 0}; }
+    int bits() const { return m[0] | m[1] << 1 | m[2] << 2 | m[3] << 3; }
+    mask4 operator&(const mask4& o) const { return {m[0] && o.m[0], m[1] && o.m[1], m[2] && o.m[2], m[3] && o.m[3]}; }
+    mask4 operator|(const mask4& o) const { return {m[0] || o.m[0], m[1] || o.m[1], m[2] || o.m[2], m[3] || o.m[3]}; }
+#endif
+    bool any() const { return bits() != 0; }
+    bool all() const { return bits() == 0xF; }
+};
+
+struct float4
+{
+#if defined(RT_SIMD_SSE)
+    __m128 v;
+    float4(__m128 vv) : v(vv) {}
+    float4() : v(_mm_setzero_ps()) {}
+    float4(float s) : v(_mm_set1_ps(s)) {}
+    float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+    static float4 load(const float* p) { return _mm_load_ps(p); }
+    static float4 loadu(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_store_ps(p, v); }
+    void storeu(float* p) const { _mm_storeu_ps(p, v); }
+    float first() const { return _mm_cvtss_f32(v); }
+    float operator[](int i) const
+    {
+        alignas(16) float t[4];
+        _mm_store_ps(t, v);
+        return t[i];
+    }
+    float4 operator+(const float4& o) const { return _mm_add_ps(v, o.v); }
+    float4 operator-(const float4& o) const { return _mm_sub_ps(v, o.v); }
+    float4 operator*(const float4& o) const { return _mm_mul_ps(v, o.v); }
+    float4 operator/(const float4& o) const { return _mm_div_ps(v, o.v); }
+    float4 operator-() const { return _mm_xor_ps(v, _mm_set1_ps(-0.f)); }
+    mask4 operator<(const float4& o) const { return _mm_cmplt_ps(v, o.v); }
+    mask4 operator<=(const float4& o) const { return _mm_cmple_ps(v, o.v); }
+    mask4 operator>(const float4& o) const { return _mm_cmpgt_ps(v, o.v); }
+    mask4 operator>=(const float4& o) const { return _mm_cmpge_ps(v, o.v); }
+    friend float4 min(const float4& a, const float4& b) { return _mm_min_ps(a.v, b.v); }
+    friend float4 max(const float4& a, const float4& b) { return _mm_max_ps(a.v, b.v); }
+    friend float4 sqrt(const float4& a) { return _mm_sqrt_ps(a.v); }
+    // approximate 1/sqrt(a) refined by one Newton-Raphson step (~23 bits)
+    friend float4 rsqrt(const float4& a)
+    {
+        __m128 r = _mm_rsqrt_ps(a.v);
+        __m128 half_a_rr = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), a.v), _mm_mul_ps(r, r));
+        return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), half_a_rr));
+    }
+    friend float4 select(const mask4& m, const float4& a, const float4& b)
+    {
+        return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+    }
+    // a.x*b.x + a.y*b.y + a.z*b.z, ignoring lane 3, broadcast to all lanes
+    friend float4 dot3(const float4& a, const float4& b)
+    {
+        __m128 p = _mm_mul_ps(a.v, b.v);
+        __m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0));
+        __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+        return _mm_add_ps(_mm_add_ps(x, y), z);
+    }
+    friend float4 cross3(const float4& a, const float4& b)
+    {
+        __m128 a_yzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a.v, b_yzx), _mm_mul_ps(a_yzx, b.v));
+        return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+    }
+#elif defined(RT_SIMD_NEON)
+    float32x4_t v;
+    float4(float32x4_t vv) : v(vv) {}
+    float4() : v(vdupq_n_f32(0)) {}
+    float4(float s) : v(vdupq_n_f32(s)) {}
+    float4(float a, float b, float c, float d) : v{a, b, c, d} {}
+    static float4 load(const float* p) { return vld1q_f32(p); }
+    static float4 loadu(const float* p) { return vld1q_f32(p); }
+    void store(float* p) const { vst1q_f32(p, v); }
+    void storeu(float* p) const { vst1q_f32(p, v); }
+    float first() const { return vgetq_lane_f32(v, 0); }
+    float operator[](int i) const
+    {
+        float t[4];
+        vst1q_f32(t, v);
+        return t[i];
+    }
+    float4 operator+(const float4& o) const { return vaddq_f32(v, o.v); }
+    float4 operator-(const float4& o) const { return vsubq_f32(v, o.v); }
+    float4 operator*(const float4& o) const { return vmulq_f32(v, o.v); }
+    float4 operator/(const float4& o) const { return vdivq_f32(v, o.v); }
+    float4 operator-() const { return vnegq_f32(v); }
+    mask4 operator<(const float4& o) const { return vcltq_f32(v, o.v); }
+    mask4 operator<=(const float4& o) const { return vcleq_f32(v, o.v); }
+    mask4 operator>(const float4& o) const { return vcgtq_f32(v, o.v); }
+    mask4 operator>=(const float4& o) const { return vcgeq_f32(v, o.v); }
+    friend float4 min(const float4& a, const float4& b) { return vbslq_f32(vcltq_f32(a.v, b.v), a.v, b.v); }
+    friend float4 max(const float4& a, const float4& b) { return vbslq_f32(vcgtq_f32(a.v, b.v), a.v, b.v); }
+    friend float4 sqrt(const float4& a) { return vsqrtq_f32(a.v); }
+    friend float4 rsqrt(const float4& a)
+    {
+        float32x4_t r = vrsqrteq_f32(a.v);
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+        return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+    }
+    friend float4 select(const mask4& m, const float4& a, const float4& b) { return vbslq_f32(m.m, a.v, b.v); }
+    friend float4 dot3(const float4& a, const float4& b)
+    {
+        float32x4_t p = vmulq_f32(a.v, b.v);
+        return vdupq_n_f32(vgetq_lane_f32(p, 0) + vgetq_lane_f32(p, 1) + vgetq_lane_f32(p, 2));
+    }
+    friend float4 cross3(const float4& a, const float4& b)
+    {
+        float t[4], u[4];
+        vst1q_f32(t, a.v);
+        vst1q_f32(u, b.v);
+        return float4(t[1] * u[2] - t[2] * u[1], t[2] * u[0] - t[0] * u[2], t[0] * u[1] - t[1] * u[0], 0);
+    }
+#else
+    float v[4];
+    float4() : v{0, 0, 0, 0} {}
+    float4(float s) : v{s, s, s, s} {}
+    float4(float a, float b, float c, float d) : v{a, b, c, d} {}
+    static float4 load(const float* p) { return {p[0], p[1], p[2], p[3]}; }
+    static float4 loadu(const float* p) { return load(p); }
+    void store(float* p) const { std::copy(v, v + 4, p); }
+    void storeu(float* p) const { store(p); }
+    float first() const { return v[0]; }
+    float operator[](int i) const { return v[i]; }
+    float4 operator+(const float4& o) const { return {v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]}; }
+    float4 operator-(const float4& o) const { return {v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3]}; }
+    float4 operator*(const float4& o) const { return {v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3]}; }
+    float4 operator/(const float4& o) const { return {v[0] / o.v[0], v[1] / o.v[1], v[2] / o.v[2], v[3] / o.v[3]}; }
+    float4 operator-() const { return {-v[0], -v[1], -v[2], -v[3]}; }
+    mask4 operator<(const float4& o) const { return {v[0] < o.v[0], v[1] < o.v[1], v[2] < o.v[2], v[3] < o.v[3]}; }
+    mask4 operator<=(const float4& o) const { return {v[0] <= o.v[0], v[1] <= o.v[1], v[2] <= o.v[2], v[3] <= o.v[3]}; }
+    mask4 operator>(const float4& o) const { return {v[0] > o.v[0], v[1] > o.v[1], v[2] > o.v[2], v[3] > o.v[3]}; }
+    mask4 operator>=(const float4& o) const { return {v[0] >= o.v[0], v[1] >= o.v[1], v[2] >= o.v[2], v[3] >= o.v[3]}; }
+    friend float4 min(const float4& a, const float4& b)
+    {
+        return {a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1], a.v[2] < b.v[2] ? a.v[2] : b.v[2],
+                a.v[3] < b.v[3] ? a.v[3] : b.v[3]};
+    }
+    friend float4 max(const float4& a, const float4& b)
+    {
+        return {a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1], a.v[2] > b.v[2] ? a.v[2] : b.v[2],
+                a.v[3] > b.v[3] ? a.v[3] : b.v[3]};
+    }
+    friend float4 sqrt(const float4& a)
+    {
+        return {std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3])};
+    }
+    friend float4 rsqrt(const float4& a) { return float4(1) / sqrt(a); }
+    friend float4 select(const mask4& m, const float4& a, const float4& b)
+    {
+        return {m.m[0] ? a.v[0] : b.v[0], m.m[1] ? a.v[1] : b.v[1], m.m[2] ? a.v[2] : b.v[2], m.m[3] ? a.v[3] : b.v[3]};
+    }
+    friend float4 dot3(const float4& a, const float4& b) { return float4(a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2]); }
+    friend float4 cross3(const float4& a, const float4& b)
+    {
+        return {a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2], a.v[0] * b.v[1] - a.v[1] * b.v[0], 0};
+    }
+#endif
+};
+
+// Lane mask produced by float8 comparisons.
+struct mask8
+{
+#if defined(RT_SIMD_AVX)
+    __m256 m;
+    mask8(__m256 mm) : m(mm) {}
+    int bits() const { return _mm256_movemask_ps(m); }
+    mask8 operator&(const mask8& o) const { return _mm256_and_ps(m, o.m); }
+    mask8 operator|(const mask8& o) const { return _mm256_or_ps(m, o.m); }
+#else
+    mask4 lo, hi;
+    mask8(const mask4& l, const mask4& h) : lo(l), hi(h) {}
+    int bits() const { return lo.bits() | hi.bits() << 4; }
+    mask8 operator&(const mask8& o) const { return {lo & o.lo, hi & o.hi}; }
+    mask8 operator|(const mask8& o) const { return {lo | o.lo, hi | o.hi}; }
+#endif
+    bool any() const { return bits() != 0; }
+};
+
+struct float8
+{
+#if defined(RT_SIMD_AVX)
+    __m256 v;
+    float8(__m256 vv) : v(vv) {}
+    float8() : v(_mm256_setzero_ps()) {}
+    float8(float s) : v(_mm256_set1_ps(s)) {}
+    // p 32-byte aligned
+    static float8 load(const float* p) { return _mm256_load_ps(p); }
+    float operator[](int i) const
+    {
+        alignas(32) float t[8];
+        _mm256_store_ps(t, v);
+        return t[i];
+    }
+    float8 operator+(const float8& o) const { return _mm256_add_ps(v, o.v); }
+    float8 operator-(const float8& o) const { return _mm256_sub_ps(v, o.v); }
+    float8 operator*(const float8& o) const { return _mm256_mul_ps(v, o.v); }
+    float8 operator/(const float8& o) const { return _mm256_div_ps(v, o.v); }
+    float8 operator-() const { return _mm256_xor_ps(v, _mm256_set1_ps(-0.f)); }
+    mask8 operator<(const float8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+    mask8 operator>=(const float8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+    friend float8 min(const float8& a, const float8& b) { return _mm256_min_ps(a.v, b.v); }
+    friend float8 max(const float8& a, const float8& b) { return _mm256_max_ps(a.v, b.v); }
+    friend float8 sqrt(const float8& a) { return _mm256_sqrt_ps(a.v); }
+    friend float8 select(const mask8& m, const float8& a, const float8& b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+#else
+    float4 lo, hi;
+    float8(const float4& l, const float4& h) : lo(l), hi(h) {}
+    float8() = default;
+    float8(float s) : lo(s), hi(s) {}
+    static float8 load(const float* p) { return {float4::load(p), float4::load(p + 4)}; }
+    float operator[](int i) const { return i < 4 ? lo[i] : hi[i - 4]; }
+    float8 operator+(const float8& o) const { return {lo + o.lo, hi + o.hi}; }
+    float8 operator-(const float8& o) const { return {lo - o.lo, hi - o.hi}; }
+    float8 operator*(const float8& o) const { return {lo * o.lo, hi * o.hi}; }
+    float8 operator/(const float8& o) const { return {lo / o.lo, hi / o.hi}; }
+    float8 operator-() const { return {-lo, -hi}; }
+    mask8 operator<(const float8& o) const { return {lo < o.lo, hi < o.hi}; }
+    mask8 operator>=(const float8& o) const { return {lo >= o.lo, hi >= o.hi}; }
+    friend float8 min(const float8& a, const float8& b) { return {min(a.lo, b.lo), min(a.hi, b.hi)}; }
+    friend float8 max(const float8& a, const float8& b) { return {max(a.lo, b.lo), max(a.hi, b.hi)}; }
+    friend float8 sqrt(const float8& a) { return {sqrt(a.lo), sqrt(a.hi)}; }
+    friend float8 select(const mask8& m, const float8& a, const float8& b)
+    {
+        return {select(m.lo, a.lo, b.lo), select(m.hi, a.hi, b.hi)};
+    }
+#endif
+};
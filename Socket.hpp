@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Connected TCP stream, closed on destruction. Reads are buffered so that text
+// lines and the binary payloads following them can be mixed freely.
+class Socket {
+public:
+  Socket() = default;
+  explicit Socket(int fd) : fd(fd) { no_delay(); }
+  ~Socket() { close(); }
+  Socket(Socket &&other) noexcept { *this = std::move(other); }
+  Socket &operator=(Socket &&other) noexcept {
+    if (this != &other) {
+      close();
+      fd = other.fd;
+      buffer = std::move(other.buffer);
+      other.fd = -1;
+    }
+    return *this;
+  }
+  Socket(const Socket &) = delete;
+  Socket &operator=(const Socket &) = delete;
+
+  // "host:port"
+  static Socket connect_to(const std::string &address) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+      throw "socket error:address is not host:port";
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (::getaddrinfo(address.substr(0, colon).c_str(),
+                      address.substr(colon + 1).c_str(), &hints, &found) != 0)
+      throw "socket error:unknown host";
+    int fd = -1;
+    for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+      fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0)
+      throw "socket error:connection refused";
+    return Socket(fd);
+  }
+
+  [[nodiscard]] bool is_open() const { return fd >= 0; }
+
+  void write(const void *data, size_t n) {
+    const char *p = static_cast<const char *>(data);
+    while (n > 0) {
+      const ssize_t sent = ::send(fd, p, n, MSG_NOSIGNAL);
+      if (sent <= 0)
+        throw "socket error:connection lost";
+      p += sent;
+      n -= sent;
+    }
+  }
+  void write(const std::string &s) { write(s.data(), s.size()); }
+
+  // exactly n bytes
+  void read(void *data, size_t n) {
+    char *p = static_cast<char *>(data);
+    const size_t buffered = std::min(n, buffer.size());
+    memcpy(p, buffer.data(), buffered);
+    buffer.erase(0, buffered);
+    for (size_t done = buffered; done < n;) {
+      const ssize_t got = ::recv(fd, p + done, n - done, 0);
+      if (got <= 0)
+        throw "socket error:connection lost";
+      done += got;
+    }
+  }
+
+  // the next line without its newline; false at the end of the stream
+  bool read_line(std::string &line) {
+    size_t end;
+    while ((end = buffer.find('\n')) == std::string::npos) {
+      char chunk[4096];
+      const ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (got == 0 && buffer.empty())
+        return false;
+      if (got <= 0)
+        throw "socket error:connection lost";
+      buffer.append(chunk, got);
+    }
+    line.assign(buffer, 0, end);
+    buffer.erase(0, end + 1);
+    return true;
+  }
+
+  void close() {
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+    buffer.clear();
+  }
+
+private:
+  // commands are short lines answered one by one; do not hold them back
+  void no_delay() {
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+
+  int fd = -1;
+  std::string buffer; // received, not yet read
+};
+
+// Listening TCP socket on every interface.
+class Listener {
+public:
+  // Listens on port of host, an address or name: the default keeps to this
+  // machine, "0.0.0.0" or "::" takes every interface.
+  explicit Listener(int port, const std::string &host = "127.0.0.1") {
+    addrinfo hints = {}, *found = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    const std::string service = std::to_string(port);
+    if (::getaddrinfo(host.c_str(), service.c_str(), &hints, &found) != 0)
+      throw "socket error:cannot resolve host";
+    fd = -1;
+    for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+      fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd < 0)
+        continue;
+      int on = 1, off = 0;
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (a->ai_family == AF_INET6)
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+      if (::bind(fd, a->ai_addr, a->ai_addrlen) != 0 || ::listen(fd, 16) != 0) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0)
+      throw "socket error:cannot listen";
+  }
+  ~Listener() { ::close(fd); }
+  Listener(const Listener &) = delete;
+  Listener &operator=(const Listener &) = delete;
+
+  // blocks for the next connection
+  Socket accept() {
+    const int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0)
+      throw "socket error:accept failed";
+    return Socket(client);
+  }
+
+private:
+  int fd;
+};
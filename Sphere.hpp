@@ -3,7 +3,47 @@
 #include "Object.hpp"
 #include "Vector.hpp"
 
-class Sphere : public Object
+// Analytic ray/sphere test; the nearest t >= 0 goes to tnear.
+inline bool raySphereIntersect(const Vector3f& orig, const Vector3f& dir, const Vector3f& center, float radius2,
+                               float& tnear)
+{
+    Vector3f L = orig - center;
+    float a = dotProduct(dir, dir);
+    float b = 2 * dotProduct(dir, L);
+    float c = dotProduct(L, L) - radius2;
+    float t0, t1;
+    if (!solveQuadratic(a, b, c, t0, t1))
+        return false;
+    if (t0 < 0)
+        t0 = t1;
+    if (t0 < 0)
+        return false;
+    tnear = t0;
+
+    return true;
+}
+
+// Packet form: lanes of activeMask hit closer than tNear, whose tNear is shrunk.
+inline int raySphereIntersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, const Vector3f& center,
+                                    float radius2)
+{
+    // same solution as solveQuadratic(), one ray per lane
+    Vector3f4 L = rays.o - Vector3f4(center);
+    float4 a = dotProduct(rays.d, rays.d);
+    float4 b = float4(2) * dotProduct(rays.d, L);
+    float4 c = dotProduct(L, L) - float4(radius2);
+    float4 discr = b * b - float4(4) * a * c;
+    float4 root = sqrt(max(discr, float4(0.f)));
+    float4 q = float4(-0.5f) * select(b > float4(0.f), b + root, b - root);
+    float4 x0 = q / a, x1 = c / q;
+    float4 t0 = min(x0, x1), t1 = max(x0, x1);
+    float4 t = select(t0 < float4(0.f), t1, t0);
+    int hitMask = ((discr >= float4(0.f)) & (t >= float4(0.f)) & (t < tNear)).bits() & activeMask;
+    tNear = select(mask4::from_bits(hitMask), t, tNear);
+    return hitMask;
+}
+
+class Sphere final : public Object
 {
 public:
     Sphere(const Vector3f& c, const float& r)
@@ -14,21 +54,12 @@ public:
 
     bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t&, Vector2f&) const override
     {
-        // analytic solution
-        Vector3f L = orig - center;
-        float a = dotProduct(dir, dir);
-        float b = 2 * dotProduct(dir, L);
-        float c = dotProduct(L, L) - radius2;
-        float t0, t1;
-        if (!solveQuadratic(a, b, c, t0, t1))
-            return false;
-        if (t0 < 0)
-            t0 = t1;
-        if (t0 < 0)
-            return false;
-        tnear = t0;
-
-        return true;
+        return raySphereIntersect(orig, dir, center, radius2, tnear);
+    }
+
+    int intersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, uint32_t*, Vector2f*) const override
+    {
+        return raySphereIntersectPacket(rays, activeMask, tNear, center, radius2);
     }
 
     void getSurfaceProperties(const Vector3f& P, const Vector3f&, const uint32_t&, const Vector2f&,
@@ -37,6 +68,11 @@ public:
         N = normalize(P - center);
     }
 
+    Bounds3 getBounds() const override
+    {
+        return Bounds3(center - Vector3f(radius), center + Vector3f(radius));
+    }
+
     Vector3f center;
     float radius, radius2;
 };
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "BVH.hpp"
+#include "Object.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Eight spheres in structure-of-arrays form: lane i of every array is sphere
+// prim[i]. Unused lanes have a negative radius2, which never hits.
+struct alignas(32) SphereGroup8
+{
+    float cx[8], cy[8], cz[8];
+    float r2[8];
+    uint32_t prim[8];
+};
+
+// A ray broadcast to eight lanes, set up once per query.
+struct SphereRay8
+{
+    explicit SphereRay8(const Vector3f& orig, const Vector3f& dir)
+        : ox(orig.x), oy(orig.y), oz(orig.z), dx(dir.x), dy(dir.y), dz(dir.z)
+    {}
+    float8 ox, oy, oz, dx, dy, dz;
+};
+
+// One ray of unit length direction against the eight spheres of a group, without
+// branches. With |dir| = 1 the quadratic reduces to t^2 + 2bt + c = 0 for
+// L = orig - center, b = dot(L, dir) and c = |L|^2 - r^2. Its discriminant is
+// taken as r^2 - |L - b dir|^2, which keeps its precision for small spheres far
+// from the ray origin where b^2 - c cancels, and the roots as q = -b -+ sqrt and
+// c / q as in solveQuadratic(), which keeps that of the root near 0 for rays
+// leaving a surface. t gets the nearest root >= 0 per lane; returns the lanes
+// hit before tMax.
+inline int raySphereGroupIntersect(const SphereGroup8& s, const SphereRay8& ray, float tMax, float8& t)
+{
+    const float8 lx = ray.ox - float8::load(s.cx);
+    const float8 ly = ray.oy - float8::load(s.cy);
+    const float8 lz = ray.oz - float8::load(s.cz);
+    const float8 r2 = float8::load(s.r2);
+    const float8 b = lx * ray.dx + ly * ray.dy + lz * ray.dz;
+    const float8 c = lx * lx + ly * ly + lz * lz - r2;
+    // L minus its projection on the ray, the closest approach to the center
+    const float8 px = lx - b * ray.dx, py = ly - b * ray.dy, pz = lz - b * ray.dz;
+    const float8 discr = r2 - (px * px + py * py + pz * pz);
+    const float8 zero(0.f);
+    const float8 root = sqrt(max(discr, zero));
+    const float8 q = -(b + select(b >= zero, root, -root));
+    const float8 x0 = q, x1 = c / q;
+    const float8 t0 = min(x0, x1), t1 = max(x0, x1);
+    t = select(t0 >= zero, t0, t1);
+    return ((discr >= zero) & (t >= zero) & (t < float8(tMax))).bits();
+}
+
+// Many spheres of one material as a single object, for particle-like scenes. Like
+// a mesh it owns a bottom-level BVH, built for leaves of up to two SphereGroup8
+// so that a leaf takes one or two eight-wide tests. A hit reports the sphere as
+// its index. Rays must have unit length directions, as all the renderer traces do.
+class SphereGroup final : public Object
+{
+public:
+    SphereGroup(std::vector<Vector3f> c, std::vector<float> r)
+        : centers(std::move(c))
+        , radii(std::move(r))
+    {
+        if (centers.size() != radii.size())
+            throw "SphereGroup error:inconsistent sphere arrays";
+        bvh = BVH(sphereBounds(), kMaxLeaf, 8, kTestCost);
+        buildGroups();
+    }
+
+    // Moves and resizes sphere i. The BVH and the groups follow on Refit(), which
+    // Scene::Update() calls for groups passed to Scene::MarkChanged().
+    void SetSphere(uint32_t i, const Vector3f& center, float radius)
+    {
+        if (i >= centers.size())
+            throw "SphereGroup error:no such sphere";
+        centers[i] = center;
+        radii[i] = radius;
+    }
+
+    // refits the BVH to the moved spheres, see BVH::RebuildDegraded() for threshold
+    void Refit(float rebuildThreshold = 1.5f)
+    {
+        const std::vector<Bounds3> bounds = sphereBounds();
+        bvh.Refit(bounds);
+        bvh.RebuildDegraded(bounds, rebuildThreshold);
+        buildGroups();
+    }
+
+    bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t& index,
+                   Vector2f&) const override
+    {
+        const SphereRay8 ray(orig, dir);
+        return bvh.IntersectLeaves(orig, dir, tnear, [&](uint32_t first, uint32_t count, float& tMax) {
+            RT_STAT_ADD(SphereTests, count);
+            bool hit = false;
+            for (uint32_t g = leafGroup[first], end = g + (count + 7) / 8; g < end; ++g)
+            {
+                float8 t;
+                int lanes = raySphereGroupIntersect(groups[g], ray, tMax, t);
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    if (!(lanes & (1 << lane)) || !(t[lane] < tMax))
+                        continue;
+                    tMax = t[lane];
+                    index = groups[g].prim[lane];
+                    hit = true;
+                }
+            }
+            return hit;
+        });
+    }
+
+    // any hit, for shadow rays
+    bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const override
+    {
+        const SphereRay8 ray(orig, dir);
+        return bvh.OccludedLeaves(orig, dir, tMax, [&](uint32_t first, uint32_t count) {
+            RT_STAT_ADD(SphereTests, count);
+            float8 t;
+            for (uint32_t g = leafGroup[first], end = g + (count + 7) / 8; g < end; ++g)
+                if (raySphereGroupIntersect(groups[g], ray, tMax, t))
+                    return true;
+            return false;
+        });
+    }
+
+    void getSurfaceProperties(const Vector3f& P, const Vector3f&, const uint32_t& index, const Vector2f&,
+                              Vector3f& N, Vector2f&) const override
+    {
+        N = normalize(P - centers[index]);
+    }
+
+    Bounds3 getBounds() const override
+    {
+        return bvh.WorldBound();
+    }
+
+    [[nodiscard]] size_t size() const { return centers.size(); }
+    [[nodiscard]] const Vector3f& get_center(uint32_t i) const { return centers[i]; }
+    [[nodiscard]] float get_radius(uint32_t i) const { return radii[i]; }
+
+private:
+    // An eight-wide test costs about as much as a BVH node visit, so leaves are
+    // worth filling: fewer, larger leaves save more visits than they add tests.
+    static constexpr int kMaxLeaf = 16;
+    static constexpr float kTestCost = 0.125f;
+
+    std::vector<Bounds3> sphereBounds() const
+    {
+        std::vector<Bounds3> bounds(centers.size());
+        for (size_t k = 0; k < centers.size(); ++k)
+            bounds[k] = Bounds3(centers[k] - Vector3f(radii[k]), centers[k] + Vector3f(radii[k]));
+        return bounds;
+    }
+
+    // Each leaf gets its own run of groups, starting at leafGroup[first entry of
+    // the leaf], with the lanes past its end padded.
+    void buildGroups()
+    {
+        ArrayView<uint32_t> order = bvh.get_prim_indices();
+        leafGroup.assign(order.size(), 0);
+        groups.clear();
+        for (const LinearBVHNode& node : bvh.get_nodes())
+        {
+            if (node.nPrimitives == 0)
+                continue;
+            leafGroup[node.offset] = groups.size();
+            for (uint32_t p = 0; p < node.nPrimitives; ++p)
+            {
+                if (p % 8 == 0)
+                {
+                    SphereGroup8 g = {};
+                    std::fill(g.r2, g.r2 + 8, -1.f);
+                    groups.push_back(g);
+                }
+                const uint32_t k = order[node.offset + p];
+                SphereGroup8& g = groups.back();
+                const int lane = p % 8;
+                g.cx[lane] = centers[k].x, g.cy[lane] = centers[k].y, g.cz[lane] = centers[k].z;
+                g.r2[lane] = radii[k] * radii[k];
+                g.prim[lane] = k;
+            }
+        }
+    }
+
+    std::vector<Vector3f> centers;
+    std::vector<float> radii;
+    BVH bvh;
+    std::vector<SphereGroup8> groups;
+    std::vector<uint32_t> leafGroup; // by leaf order position
+};
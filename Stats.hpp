@@ -0,0 +1,250 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifdef RT_STATS
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#endif
+
+// Render statistics, collected only in builds with RT_STATS defined; otherwise
+// RT_STAT() and RT_STAT_ADD() expand to nothing, arguments included.
+enum class Stat {
+  PrimaryRays,
+  ReflectionRays,
+  RefractionRays,
+  ShadowRays,
+  // primitive tests, a packet test counting one per active lane
+  SphereTests,
+  MeshTests, // also sphere groups, whose spheres count as SphereTests
+  InstanceTests,
+  OtherTests,
+  TriangleTests,
+  BvhNodes, // node visits of every BVH, a packet visit counting once
+  // calls of the global operator new, in programs with RT_COUNT_ALLOCATIONS()
+  Allocations,
+  Count
+};
+
+constexpr int kNumStats = (int)Stat::Count;
+
+constexpr const char *kStatNames[kNumStats] = {
+    "primary_rays",  "reflection_rays", "refraction_rays", "shadow_rays",
+    "sphere_tests",  "mesh_tests",      "instance_tests",  "other_tests",
+    "triangle_tests", "bvh_nodes",      "allocations"};
+
+// lanes in a packet mask, for counting packet tests per ray
+constexpr int count_lanes(int mask) {
+  return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+
+#ifdef RT_STATS
+constexpr bool kStatsEnabled = true;
+
+namespace stats_detail {
+
+// Counters of one thread. Only the owner writes them, so an increment is a
+// plain load and store; the atomics just make reads from other threads
+// well-defined. work sums the tests and node visits, the cost of a pixel.
+struct ThreadCounters {
+  std::atomic<uint64_t> values[kNumStats] = {};
+  std::atomic<uint64_t> work{0};
+};
+
+struct Registry {
+  std::mutex mutex;
+  // shared so that the counts of exited threads are kept
+  std::vector<std::shared_ptr<ThreadCounters>> threads;
+};
+
+inline Registry &registry() {
+  static Registry r;
+  return r;
+}
+
+inline ThreadCounters &local() {
+  thread_local std::shared_ptr<ThreadCounters> counters = [] {
+    auto c = std::make_shared<ThreadCounters>();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().threads.push_back(c);
+    return c;
+  }();
+  return *counters;
+}
+
+inline void bump(std::atomic<uint64_t> &c, uint64_t n) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Shared by the threads: registering a thread's counters allocates, so the
+// counter operator new bumps cannot be one of them.
+inline std::atomic<uint64_t> &allocations() {
+  static std::atomic<uint64_t> count{0};
+  return count;
+}
+
+} // namespace stats_detail
+
+inline void stat_add(Stat stat, uint64_t n) {
+  stats_detail::ThreadCounters &c = stats_detail::local();
+  stats_detail::bump(c.values[(int)stat], n);
+  if (stat >= Stat::SphereTests && stat <= Stat::BvhNodes)
+    stats_detail::bump(c.work, n);
+}
+
+// work done so far on the calling thread; differences give the cost of a pixel
+inline uint64_t stat_work() {
+  return stats_detail::local().work.load(std::memory_order_relaxed);
+}
+
+// rays of all types traced so far on the calling thread
+inline uint64_t stat_rays() {
+  stats_detail::ThreadCounters &c = stats_detail::local();
+  uint64_t rays = 0;
+  for (Stat s : {Stat::PrimaryRays, Stat::ReflectionRays, Stat::RefractionRays,
+                 Stat::ShadowRays})
+    rays += c.values[(int)s].load(std::memory_order_relaxed);
+  return rays;
+}
+
+// sum over all threads; call while no thread is counting
+inline void stats_collect(uint64_t totals[kNumStats]) {
+  auto &r = stats_detail::registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (int s = 0; s < kNumStats; ++s)
+    totals[s] = 0;
+  for (auto &c : r.threads)
+    for (int s = 0; s < kNumStats; ++s)
+      totals[s] += c->values[s].load(std::memory_order_relaxed);
+  totals[(int)Stat::Allocations] =
+      stats_detail::allocations().load(std::memory_order_relaxed);
+}
+
+inline void stats_reset() {
+  auto &r = stats_detail::registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (auto &c : r.threads) {
+    for (auto &v : c->values)
+      v.store(0, std::memory_order_relaxed);
+    c->work.store(0, std::memory_order_relaxed);
+  }
+  stats_detail::allocations().store(0, std::memory_order_relaxed);
+}
+
+#define RT_STAT_ADD(stat, n) stat_add(Stat::stat, (n))
+
+// Replaces the global operator new and delete with ones counting into
+// Stat::Allocations. A program may replace them only once, so this goes at
+// namespace scope in one source file of the program. They are kept out of
+// line so the compiler does not pair malloc() and free() with new and delete.
+#define RT_COUNT_ALLOCATIONS()                                                 \
+  __attribute__((noinline)) void *operator new(std::size_t n) {                \
+    stats_detail::allocations().fetch_add(1, std::memory_order_relaxed);       \
+    if (void *p = std::malloc(n ? n : 1))                                      \
+      return p;                                                                \
+    throw std::bad_alloc();                                                    \
+  }                                                                            \
+  __attribute__((noinline)) void *operator new(std::size_t n,                  \
+                                               std::align_val_t a) {           \
+    stats_detail::allocations().fetch_add(1, std::memory_order_relaxed);       \
+    const std::size_t align = (std::size_t)a;                                  \
+    if (void *p = std::aligned_alloc(align, (n + align - 1) / align * align))  \
+      return p;                                                                \
+    throw std::bad_alloc();                                                    \
+  }                                                                            \
+  __attribute__((noinline)) void operator delete(void *p) noexcept {           \
+    std::free(p);                                                              \
+  }                                                                            \
+  __attribute__((noinline)) void operator delete(void *p,                      \
+                                                 std::size_t) noexcept {       \
+    std::free(p);                                                              \
+  }                                                                            \
+  __attribute__((noinline)) void operator delete(void *p,                      \
+                                                 std::align_val_t) noexcept {  \
+    std::free(p);                                                              \
+  }                                                                            \
+  __attribute__((noinline)) void operator delete(                              \
+      void *p, std::size_t, std::align_val_t) noexcept {                       \
+    std::free(p);                                                              \
+  }
+#else
+constexpr bool kStatsEnabled = false;
+inline uint64_t stat_work() { return 0; }
+inline uint64_t stat_rays() { return 0; }
+inline void stats_collect(uint64_t[kNumStats]) {}
+inline void stats_reset() {}
+#define RT_STAT_ADD(stat, n) ((void)0)
+#define RT_COUNT_ALLOCATIONS()
+#endif
+#define RT_STAT(stat) RT_STAT_ADD(stat, 1)
+
+// Statistics of one frame: the counters summed over the threads, and the wall
+// time and traced rays of every tile, summed over the passes that rendered it.
+struct FrameStats {
+  struct Tile {
+    uint32_t tile;
+    double seconds;
+    uint64_t rays;
+  };
+
+  uint64_t counters[kNumStats] = {};
+  std::vector<Tile> tiles;
+  double seconds = 0;
+
+  [[nodiscard]] uint64_t rays() const {
+    return counters[(int)Stat::PrimaryRays] +
+           counters[(int)Stat::ReflectionRays] +
+           counters[(int)Stat::RefractionRays] +
+           counters[(int)Stat::ShadowRays];
+  }
+};
+
+// Adds the time and the rays traced on this thread during its lifetime to
+// stats.tiles[index].
+#ifdef RT_STATS
+class TileTimer {
+public:
+  TileTimer(FrameStats &stats, uint32_t index)
+      : tile(stats.tiles[index]), start(std::chrono::steady_clock::now()), rays(stat_rays()) {}
+  ~TileTimer() {
+    tile.seconds += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    tile.rays += stat_rays() - rays;
+  }
+
+private:
+  FrameStats::Tile &tile;
+  std::chrono::steady_clock::time_point start;
+  uint64_t rays;
+};
+#else
+struct TileTimer {
+  TileTimer(FrameStats &, uint32_t) {}
+};
+#endif
+
+inline void write_stats_json(const std::string &path, const FrameStats &stats) {
+  std::ofstream out(path);
+  if (!out)
+    throw "stats error:file cannot open";
+  out << "{\n  \"seconds\": " << stats.seconds
+      << ",\n  \"mrays_per_s\": " << stats.rays() / stats.seconds * 1e-6
+      << ",\n  \"counters\": {";
+  for (int s = 0; s < kNumStats; ++s)
+    out << (s ? ", " : "") << "\"" << kStatNames[s] << "\": " << stats.counters[s];
+  out << "},\n  \"tiles\": [";
+  for (size_t k = 0; k < stats.tiles.size(); ++k) {
+    const FrameStats::Tile &t = stats.tiles[k];
+    out << (k ? ",\n" : "\n") << "    {\"tile\": " << t.tile
+        << ", \"seconds\": " << t.seconds << ", \"rays\": " << t.rays
+        << ", \"mrays_per_s\": " << (t.seconds > 0 ? t.rays / t.seconds * 1e-6 : 0)
+        << "}";
+  }
+  out << "\n  ]\n}\n";
+}
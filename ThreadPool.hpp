@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size pool of persistent workers running index-space jobs. Every worker
+// owns a queue seeded with a contiguous slice of the job; it pops from the front
+// of its own queue and, once that runs dry, steals from the back of the others,
+// so uneven per-item cost balances out without a shared queue. A queue stays a
+// contiguous range of indices, and the task is referenced rather than copied,
+// so starting a job allocates nothing.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned numThreads = std::thread::hardware_concurrency())
+        : queues(std::max(1u, numThreads))
+    {
+        for (unsigned w = 1; w < queues.size(); ++w)
+            workers.emplace_back([this, w] { workerLoop(w); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] unsigned size() const { return queues.size(); }
+
+    // Runs task(index, worker) for every index in [0, count) and blocks until all
+    // of them finished. The calling thread takes part as worker 0. The first
+    // exception thrown by a task is rethrown here once the job drained.
+    template <typename F>
+    void parallel_for(size_t count, F&& task)
+    {
+        using Task = std::remove_reference_t<F>;
+        run(count, {const_cast<void*>(static_cast<const void*>(std::addressof(task))),
+                    [](void* f, size_t index, unsigned worker) { (*static_cast<Task*>(f))(index, worker); }});
+    }
+
+private:
+    // type-erased reference to the task of a job, which outlives the job
+    struct TaskRef
+    {
+        void* task;
+        void (*call)(void*, size_t, unsigned);
+        void operator()(size_t index, unsigned worker) const { call(task, index, worker); }
+    };
+
+    void run(size_t count, const TaskRef& task)
+    {
+        if (count == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const size_t n = queues.size();
+            for (size_t w = 0; w < n; ++w)
+            {
+                std::lock_guard<std::mutex> queueLock(queues[w].mutex);
+                queues[w].front = count * w / n;
+                queues[w].back = count * (w + 1) / n;
+            }
+            job = &task;
+            error = nullptr;
+            pending = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        runItems(0, task);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // the indices [front, back) not yet taken
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        size_t front = 0, back = 0;
+    };
+
+    bool nextItem(unsigned worker, size_t& item)
+    {
+        {
+            WorkQueue& own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.front < own.back)
+            {
+                item = own.front++;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k)
+        {
+            WorkQueue& victim = queues[(worker + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.front < victim.back)
+            {
+                item = --victim.back;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runItems(unsigned worker, const TaskRef& task)
+    {
+        size_t item;
+        while (nextItem(worker, item))
+        {
+            try
+            {
+                task(item, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    }
+
+    void workerLoop(unsigned worker)
+    {
+        size_t seen = 0;
+        while (true)
+        {
+            const TaskRef* task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop)
+                    return;
+                seen = generation;
+                task = job;
+            }
+            runItems(worker, *task);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0)
+                    done.notify_one();
+            }
+        }
+    }
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const TaskRef* job = nullptr;
+    std::exception_ptr error;
+    size_t pending = 0;
+    size_t generation = 0;
+    bool stop = false;
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "Bounds3.hpp"
+#include "RayPacket.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+
+#include <cmath>
+
+// Affine transform stored as a 3x4 row-major matrix together with its inverse.
+class Transform
+{
+public:
+    Transform()
+        : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}
+        , inv{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}
+    {}
+
+    // rows of [linear | translation]; throws on a singular linear part
+    explicit Transform(const float mat[3][4])
+    {
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                m[r][c] = mat[r][c];
+        invert(m, inv);
+    }
+
+    static Transform Translate(const Vector3f& t)
+    {
+        const float mat[3][4] = {{1, 0, 0, t.x}, {0, 1, 0, t.y}, {0, 0, 1, t.z}};
+        return Transform(mat);
+    }
+
+    static Transform Scale(const Vector3f& s)
+    {
+        const float mat[3][4] = {{s.x, 0, 0, 0}, {0, s.y, 0, 0}, {0, 0, s.z, 0}};
+        return Transform(mat);
+    }
+
+    // counterclockwise about axis, looking down the axis towards the origin
+    static Transform Rotate(const Vector3f& axis, float degrees)
+    {
+        Vector3f a = normalize(axis);
+        float theta = degrees * M_PI / 180;
+        float s = std::sin(theta), c = std::cos(theta);
+        const float mat[3][4] = {
+            {a.x * a.x + (1 - a.x * a.x) * c, a.x * a.y * (1 - c) - a.z * s, a.x * a.z * (1 - c) + a.y * s, 0},
+            {a.x * a.y * (1 - c) + a.z * s, a.y * a.y + (1 - a.y * a.y) * c, a.y * a.z * (1 - c) - a.x * s, 0},
+            {a.x * a.z * (1 - c) - a.y * s, a.y * a.z * (1 - c) + a.x * s, a.z * a.z + (1 - a.z * a.z) * c, 0}};
+        return Transform(mat);
+    }
+
+    // applies o first, then this
+    Transform operator*(const Transform& o) const
+    {
+        float mat[3][4];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 4; ++c)
+                mat[r][c] = m[r][0] * o.m[0][c] + m[r][1] * o.m[1][c] + m[r][2] * o.m[2][c];
+            mat[r][3] += m[r][3];
+        }
+        return Transform(mat);
+    }
+
+    Transform Inverse() const
+    {
+        Transform t;
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+            {
+                t.m[r][c] = inv[r][c];
+                t.inv[r][c] = m[r][c];
+            }
+        return t;
+    }
+
+    // entry of the 3x4 matrix
+    float get(int row, int col) const { return m[row][col]; }
+
+    Vector3f Point(const Vector3f& p) const
+    {
+        return Vector3f(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                        m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                        m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+
+    Vector3f Vector(const Vector3f& v) const
+    {
+        return Vector3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z, m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                        m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    // by the inverse transpose, so normals stay perpendicular to surfaces; not normalized
+    Vector3f Normal(const Vector3f& n) const
+    {
+        return Vector3f(inv[0][0] * n.x + inv[1][0] * n.y + inv[2][0] * n.z,
+                        inv[0][1] * n.x + inv[1][1] * n.y + inv[2][1] * n.z,
+                        inv[0][2] * n.x + inv[1][2] * n.y + inv[2][2] * n.z);
+    }
+
+    Vector3f4 Point(const Vector3f4& p) const
+    {
+        return Vector3f4(float4(m[0][0]) * p.x + float4(m[0][1]) * p.y + float4(m[0][2]) * p.z + float4(m[0][3]),
+                         float4(m[1][0]) * p.x + float4(m[1][1]) * p.y + float4(m[1][2]) * p.z + float4(m[1][3]),
+                         float4(m[2][0]) * p.x + float4(m[2][1]) * p.y + float4(m[2][2]) * p.z + float4(m[2][3]));
+    }
+
+    Vector3f4 Vector(const Vector3f4& v) const
+    {
+        return Vector3f4(float4(m[0][0]) * v.x + float4(m[0][1]) * v.y + float4(m[0][2]) * v.z,
+                         float4(m[1][0]) * v.x + float4(m[1][1]) * v.y + float4(m[1][2]) * v.z,
+                         float4(m[2][0]) * v.x + float4(m[2][1]) * v.y + float4(m[2][2]) * v.z);
+    }
+
+    // box around the transformed corners of b
+    Bounds3 operator()(const Bounds3& b) const
+    {
+        Bounds3 ret(Point(b.pMin));
+        for (int i = 1; i < 8; ++i)
+            ret = Union(ret, Point(Vector3f(i & 1 ? b.pMax.x : b.pMin.x, i & 2 ? b.pMax.y : b.pMin.y,
+                                            i & 4 ? b.pMax.z : b.pMin.z)));
+        return ret;
+    }
+
+private:
+    static void invert(const float a[3][4], float out[3][4])
+    {
+        // cofactors of the linear part
+        float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+        if (det == 0 || !std::isfinite(det))
+            throw "Transform error:singular matrix";
+        float invDet = 1 / det;
+        out[0][0] = c00 * invDet;
+        out[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * invDet;
+        out[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * invDet;
+        out[1][0] = c01 * invDet;
+        out[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * invDet;
+        out[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * invDet;
+        out[2][0] = c02 * invDet;
+        out[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * invDet;
+        out[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * invDet;
+        for (int r = 0; r < 3; ++r)
+            out[r][3] = -(out[r][0] * a[0][3] + out[r][1] * a[1][3] + out[r][2] * a[2][3]);
+    }
+
+    float m[3][4];
+    float inv[3][4];
+};
@@ -1,9 +1,10 @@
 #pragma once
 
+#include "BVH.hpp"
 #include "Object.hpp"
 
-#include <cstring>
 #include <memory>
+#include <vector>
 
 inline bool rayTriangleIntersect(const Vector3f& p0, const Vector3f& p1, const Vector3f& p2, const Vector3f& orig,
     const Vector3f& dir, float& tnear, float& u, float& v)
@@ -16,52 +17,198 @@ inline bool rayTriangleIntersect(const Vector3f& p0, const Vector3f& p1, const V
    tnear=t;
    u=b1;
    v=b2;
-   if(t>=0 && clamp(0,1,b1)==b1 && clamp(0,1,b2)==b2){
+   if(t>=0 && clamp(0,1,b1)==b1 && clamp(0,1,b2)==b2 && b1+b2<=1){
     return true;
    }
    return false;
 }
 
-class MeshTriangle : public Object
+// How MeshTriangle::intersect reads its triangles.
+enum class TriangleStorage
+{
+    // dereference vertexIndex and build the edges per test (least memory)
+    Indexed,
+    // additionally keep v0, e1, e2 of every triangle in SoA groups of four in BVH
+    // leaf order, tested four at a time (~2x the vertex memory, faster)
+    Precomputed
+};
+
+// Four triangles in structure-of-arrays form: lane i of every array is triangle
+// prim[i]. Unused lanes are zero, which makes their determinant 0 and never hits.
+struct alignas(16) TriangleGroup4
+{
+    float v0x[4], v0y[4], v0z[4];
+    float e1x[4], e1y[4], e1z[4];
+    float e2x[4], e2y[4], e2z[4];
+    uint32_t prim[4];
+};
+
+// Arrays of a mesh that live outside of it, e.g. in a mapped scene cache. nodes
+// and primIndices hold a BVH over the triangles built for exactly these arrays.
+struct MeshArrays
+{
+    const Vector3f* vertices;
+    const uint32_t* vertexIndex; // 3 per triangle
+    const Vector2f* stCoordinates;
+    uint32_t numVertices, numTriangles;
+    const LinearBVHNode* nodes;
+    uint32_t numNodes;
+    const uint32_t* primIndices; // numTriangles entries
+};
+
+// Indexed triangle mesh. Each mesh owns a bottom-level BVH over its triangles, so
+// the scene BVH (the top level) only ever sees the mesh as a single primitive.
+class MeshTriangle final : public Object
 {
 public:
-    MeshTriangle(const Vector3f* verts, const uint32_t* vertsIndex, const uint32_t& numTris, const Vector2f* st)
+    MeshTriangle(const Vector3f* verts, const uint32_t* vertsIndex, const uint32_t& numTris, const Vector2f* st,
+                 TriangleStorage storage = TriangleStorage::Indexed)
+        : MeshTriangle(std::vector<Vector3f>(verts, verts + numVerticesOf(vertsIndex, numTris)),
+                       std::vector<uint32_t>(vertsIndex, vertsIndex + numTris * 3),
+                       std::vector<Vector2f>(st, st + numVerticesOf(vertsIndex, numTris)), storage)
+    {}
+
+    // Takes the arrays over without copying them; st holds one entry per vertex.
+    MeshTriangle(std::vector<Vector3f> verts, std::vector<uint32_t> vertsIndex, std::vector<Vector2f> st,
+                 TriangleStorage storage = TriangleStorage::Indexed)
     {
-        uint32_t maxIndex = 0;
-        for (uint32_t i = 0; i < numTris * 3; ++i)
-            if (vertsIndex[i] > maxIndex)
-                maxIndex = vertsIndex[i];
-        maxIndex += 1;
-        vertices = std::unique_ptr<Vector3f[]>(new Vector3f[maxIndex]);
-        memcpy(vertices.get(), verts, sizeof(Vector3f) * maxIndex);
-        vertexIndex = std::unique_ptr<uint32_t[]>(new uint32_t[numTris * 3]);
-        memcpy(vertexIndex.get(), vertsIndex, sizeof(uint32_t) * numTris * 3);
-        numTriangles = numTris;
-        stCoordinates = std::unique_ptr<Vector2f[]>(new Vector2f[maxIndex]);
-        memcpy(stCoordinates.get(), st, sizeof(Vector2f) * maxIndex);
+        if (vertsIndex.size() % 3 != 0 || st.size() != verts.size() ||
+            numVerticesOf(vertsIndex.data(), vertsIndex.size() / 3) > verts.size())
+            throw "MeshTriangle error:inconsistent mesh arrays";
+        auto arrays = std::make_shared<OwnedArrays>();
+        arrays->vertices = std::move(verts);
+        arrays->vertexIndex = std::move(vertsIndex);
+        arrays->stCoordinates = std::move(st);
+        vertices = writableVertices = arrays->vertices.data();
+        vertexIndex = arrays->vertexIndex.data();
+        stCoordinates = arrays->stCoordinates.data();
+        numVertices = arrays->vertices.size();
+        numTriangles = arrays->vertexIndex.size() / 3;
+        owner = std::move(arrays);
+
+        bvh = BVH(triangleBounds());
+        if (storage == TriangleStorage::Precomputed)
+            buildTriangleGroups();
+    }
+
+    // Uses arrays and BVH in place, without copying; owner keeps them alive.
+    MeshTriangle(const MeshArrays& arrays, std::shared_ptr<const void> arrayOwner,
+                 TriangleStorage storage = TriangleStorage::Indexed)
+        : vertices(arrays.vertices)
+        , numVertices(arrays.numVertices)
+        , numTriangles(arrays.numTriangles)
+        , vertexIndex(arrays.vertexIndex)
+        , stCoordinates(arrays.stCoordinates)
+        , bvh(BVH::Adopt(arrays.nodes, arrays.numNodes, arrays.primIndices, arrays.numTriangles))
+        , owner(std::move(arrayOwner))
+    {
+        if (storage == TriangleStorage::Precomputed)
+            buildTriangleGroups();
+    }
+
+    // Moves vertex i. The BVH and the precomputed triangles follow on Refit(),
+    // which Scene::Update() calls for meshes passed to Scene::MarkChanged().
+    // Arrays adopted from a scene cache are copied on the first move.
+    void SetVertex(uint32_t i, const Vector3f& p)
+    {
+        if (i >= numVertices)
+            throw "MeshTriangle error:no such vertex";
+        if (!writableVertices)
+        {
+            editedVertices.assign(vertices, vertices + numVertices);
+            vertices = writableVertices = editedVertices.data();
+        }
+        writableVertices[i] = p;
+    }
+
+    // refits the BVH to the moved vertices, see BVH::RebuildDegraded() for threshold
+    void Refit(float rebuildThreshold = 1.5f)
+    {
+        const std::vector<Bounds3> bounds = triangleBounds();
+        bvh.Refit(bounds);
+        bvh.RebuildDegraded(bounds, rebuildThreshold);
+        if (!groups.empty())
+            buildTriangleGroups();
+    }
+
+    [[nodiscard]] TriangleStorage get_storage() const
+    {
+        return groups.empty() ? TriangleStorage::Indexed : TriangleStorage::Precomputed;
     }
 
     bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t& index,
                    Vector2f& uv) const override
     {
-        bool intersect = false;
-        for (uint32_t k = 0; k < numTriangles; ++k)
-        {
+        if (!groups.empty())
+            return bvh.IntersectLeaves(orig, dir, tnear, [&](uint32_t first, uint32_t count, float& tMax) {
+                return intersectGroups(orig, dir, first, count, tMax, index, uv);
+            });
+        return bvh.Intersect(orig, dir, tnear, [&](uint32_t k, float& tMax) {
             const Vector3f& v0 = vertices[vertexIndex[k * 3]];
             const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
             const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
             float t, u, v;
-            if (rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) && t < tnear)
+            RT_STAT(TriangleTests);
+            if (rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) && t < tMax)
             {
-                tnear = t;
+                tMax = t;
                 uv.x = u;
                 uv.y = v;
                 index = k;
-                intersect |= true;
+                return true;
             }
-        }
+            return false;
+        });
+    }
+
+    bool occluded(const Vector3f& orig, const Vector3f& dir, float tMax) const override
+    {
+        if (!groups.empty())
+            return bvh.OccludedLeaves(orig, dir, tMax, [&](uint32_t first, uint32_t count) {
+                return occludedGroups(orig, dir, first, count, tMax);
+            });
+        return bvh.Occluded(orig, dir, tMax, [&](uint32_t k) {
+            float t, u, v;
+            RT_STAT(TriangleTests);
+            return rayTriangleIntersect(vertices[vertexIndex[k * 3]], vertices[vertexIndex[k * 3 + 1]],
+                                        vertices[vertexIndex[k * 3 + 2]], orig, dir, t, u, v) &&
+                   t < tMax;
+        });
+    }
 
-        return intersect;
+    int intersectPacket(const RayPacket4& rays, int activeMask, float4& tNear, uint32_t index[4],
+                        Vector2f uv[4]) const override
+    {
+        return bvh.IntersectPacket(rays, activeMask, tNear, [&](uint32_t k, int mask, float4& tMax) {
+            // rayTriangleIntersect() with the triangle broadcast and one ray per lane
+            RT_STAT_ADD(TriangleTests, count_lanes(mask));
+            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
+            const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
+            const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
+            Vector3f4 e1(v1 - v0), e2(v2 - v0), s = rays.o - Vector3f4(v0);
+            Vector3f4 s1 = crossProduct(rays.d, e2), s2 = crossProduct(s, e1);
+            float4 det = dotProduct(s1, e1);
+            float4 t = dotProduct(s2, e2) / det;
+            float4 b1 = dotProduct(s1, s) / det;
+            float4 b2 = dotProduct(s2, rays.d) / det;
+            const float4 zero(0.f), one(1.f);
+            int hits = ((t >= zero) & (b1 >= zero) & (b1 <= one) & (b2 >= zero) & (b2 <= one) &
+                        (b1 + b2 <= one) & (t < tMax))
+                           .bits() &
+                       mask;
+            if (!hits)
+                return 0;
+            tMax = select(mask4::from_bits(hits), t, tMax);
+            for (int i = 0; i < RayPacket4::kSize; ++i)
+            {
+                if (hits & (1 << i))
+                {
+                    index[i] = k;
+                    uv[i] = Vector2f(b1[i], b2[i]);
+                }
+            }
+            return hits;
+        });
     }
 
     void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t& index, const Vector2f& uv, Vector3f& N,
@@ -79,15 +226,143 @@ public:
         st = st0 * (1 - uv.x - uv.y) + st1 * uv.x + st2 * uv.y;
     }
 
-    Vector3f evalDiffuseColor(const Vector2f& st) const override
+    Bounds3 getBounds() const override
+    {
+        return bvh.WorldBound();
+    }
+
+    Vector3f evalDiffuseColor(const Material&, const Vector2f& st) const override
     {
         float scale = 5;
         float pattern = (fmodf(st.x * scale, 1) > 0.5) ^ (fmodf(st.y * scale, 1) > 0.5);
         return lerp(Vector3f(0.815, 0.235, 0.031), Vector3f(0.937, 0.937, 0.231), pattern);
     }
 
-    std::unique_ptr<Vector3f[]> vertices;
+    const Vector3f* vertices;
+    uint32_t numVertices;
     uint32_t numTriangles;
-    std::unique_ptr<uint32_t[]> vertexIndex;
-    std::unique_ptr<Vector2f[]> stCoordinates;
+    const uint32_t* vertexIndex;
+    const Vector2f* stCoordinates;
+    BVH bvh;
+
+private:
+    // 1 + the largest vertex index
+    static size_t numVerticesOf(const uint32_t* vertsIndex, size_t numTris)
+    {
+        uint32_t maxIndex = 0;
+        for (size_t i = 0; i < numTris * 3; ++i)
+            if (vertsIndex[i] > maxIndex)
+                maxIndex = vertsIndex[i];
+        return numTris ? maxIndex + 1 : 0;
+    }
+
+    std::vector<Bounds3> triangleBounds() const
+    {
+        std::vector<Bounds3> bounds(numTriangles);
+        for (uint32_t k = 0; k < numTriangles; ++k)
+            bounds[k] = Union(Bounds3(vertices[vertexIndex[k * 3]], vertices[vertexIndex[k * 3 + 1]]),
+                              vertices[vertexIndex[k * 3 + 2]]);
+        return bounds;
+    }
+
+    struct OwnedArrays
+    {
+        std::vector<Vector3f> vertices;
+        std::vector<uint32_t> vertexIndex;
+        std::vector<Vector2f> stCoordinates;
+    };
+    // keeps the arrays above alive
+    std::shared_ptr<const void> owner;
+    // vertices when they may be moved: the owned array, or a copy of adopted ones
+    Vector3f* writableVertices = nullptr;
+    std::vector<Vector3f> editedVertices;
+
+    // Group g holds the triangles at BVH leaf order positions [4g, 4g + 4), so a
+    // leaf maps onto a run of groups with the lanes outside it masked off.
+    void buildTriangleGroups()
+    {
+        ArrayView<uint32_t> order = bvh.get_prim_indices();
+        groups.assign((order.size() + 3) / 4, TriangleGroup4{});
+        for (size_t p = 0; p < order.size(); ++p)
+        {
+            const uint32_t k = order[p];
+            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
+            Vector3f e1 = vertices[vertexIndex[k * 3 + 1]] - v0;
+            Vector3f e2 = vertices[vertexIndex[k * 3 + 2]] - v0;
+            TriangleGroup4& g = groups[p / 4];
+            const size_t lane = p % 4;
+            g.v0x[lane] = v0.x, g.v0y[lane] = v0.y, g.v0z[lane] = v0.z;
+            g.e1x[lane] = e1.x, g.e1y[lane] = e1.y, g.e1z[lane] = e1.z;
+            g.e2x[lane] = e2.x, g.e2y[lane] = e2.y, g.e2z[lane] = e2.z;
+            g.prim[lane] = k;
+        }
+    }
+
+    // lanes of group g that lie in the leaf positions [first, first + count)
+    static int leafLanes(uint32_t g, uint32_t first, uint32_t count)
+    {
+        int lanes = 0;
+        for (int lane = 0; lane < 4; ++lane)
+            if (g * 4 + lane >= first && g * 4 + lane < first + count)
+                lanes |= 1 << lane;
+        return lanes;
+    }
+
+    // One ray against the four triangles of a group, with a single reciprocal of
+    // the determinant per triangle. Returns the lanes hit before tMax.
+    int intersectGroup(const TriangleGroup4& tri, const Vector3f4& o, const Vector3f4& d, float tMax, float4& t,
+                       float4& b1, float4& b2) const
+    {
+        const float4 zero(0.f), one(1.f);
+        Vector3f4 v0(float4::load(tri.v0x), float4::load(tri.v0y), float4::load(tri.v0z));
+        Vector3f4 e1(float4::load(tri.e1x), float4::load(tri.e1y), float4::load(tri.e1z));
+        Vector3f4 e2(float4::load(tri.e2x), float4::load(tri.e2y), float4::load(tri.e2z));
+        Vector3f4 s = o - v0;
+        Vector3f4 s1 = crossProduct(d, e2), s2 = crossProduct(s, e1);
+        float4 invDet = one / dotProduct(s1, e1);
+        t = dotProduct(s2, e2) * invDet;
+        b1 = dotProduct(s1, s) * invDet;
+        b2 = dotProduct(s2, d) * invDet;
+        return ((t >= zero) & (b1 >= zero) & (b2 >= zero) & (b1 + b2 <= one) & (t < float4(tMax))).bits();
+    }
+
+    // closest hit among the leaf positions [first, first + count)
+    bool intersectGroups(const Vector3f& orig, const Vector3f& dir, uint32_t first, uint32_t count, float& tMax,
+                         uint32_t& index, Vector2f& uv) const
+    {
+        const Vector3f4 o(orig), d(dir);
+        bool hit = false;
+        for (uint32_t g = first / 4; g * 4 < first + count; ++g)
+        {
+            const TriangleGroup4& tri = groups[g];
+            float4 t, b1, b2;
+            RT_STAT_ADD(TriangleTests, count_lanes(leafLanes(g, first, count)));
+            int lanes = intersectGroup(tri, o, d, tMax, t, b1, b2) & leafLanes(g, first, count);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (!(lanes & (1 << lane)) || !(t[lane] < tMax))
+                    continue;
+                tMax = t[lane];
+                uv = Vector2f(b1[lane], b2[lane]);
+                index = tri.prim[lane];
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+    bool occludedGroups(const Vector3f& orig, const Vector3f& dir, uint32_t first, uint32_t count, float tMax) const
+    {
+        const Vector3f4 o(orig), d(dir);
+        for (uint32_t g = first / 4; g * 4 < first + count; ++g)
+        {
+            float4 t, b1, b2;
+            RT_STAT_ADD(TriangleTests, count_lanes(leafLanes(g, first, count)));
+            if (intersectGroup(groups[g], o, d, tMax, t, b1, b2) & leafLanes(g, first, count))
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<TriangleGroup4> groups;
 };
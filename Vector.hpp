@@ -1,10 +1,42 @@
 #pragma once
 
+#include "Simd.hpp"
+
 #include <cmath>
 #include <iostream>
 
-class Vector3f {
+// With RT_SIMD the vector is padded to 16 bytes (w is always 0 on construction,
+// don't care afterwards) so the operators below run on one SIMD register each.
+// The x, y, z members and every function keep their scalar meaning either way.
+#ifdef RT_SIMD_ENABLED
+#define RT_VECTOR3F_ALIGN alignas(16)
+#else
+#define RT_VECTOR3F_ALIGN
+#endif
+
+class RT_VECTOR3F_ALIGN Vector3f {
 public:
+#ifdef RT_SIMD_ENABLED
+  Vector3f() : x(0), y(0), z(0), w(0) {}
+  Vector3f(float xx) : x(xx), y(xx), z(xx), w(0) {}
+  Vector3f(float xx, float yy, float zz) : x(xx), y(yy), z(zz), w(0) {}
+  Vector3f(const float4 &v) { v.store(&x); }
+  float4 simd() const { return float4::load(&x); }
+
+  Vector3f operator*(const float &r) const { return simd() * float4(r); }
+  Vector3f operator/(const float &r) const { return simd() / float4(r); }
+  Vector3f operator*(const Vector3f &v) const { return simd() * v.simd(); }
+  Vector3f operator-(const Vector3f &v) const { return simd() - v.simd(); }
+  Vector3f operator+(const Vector3f &v) const { return simd() + v.simd(); }
+  Vector3f operator-() const { return -simd(); }
+  Vector3f &operator+=(const Vector3f &v) {
+    (simd() + v.simd()).store(&x);
+    return *this;
+  }
+  friend Vector3f operator*(const float &r, const Vector3f &v) {
+    return v.simd() * float4(r);
+  }
+#else
   Vector3f() : x(0), y(0), z(0) {}
   Vector3f(float xx) : x(xx), y(xx), z(xx) {}
   Vector3f(float xx, float yy, float zz) : x(xx), y(yy), z(zz) {}
@@ -32,10 +64,15 @@ public:
   friend Vector3f operator*(const float &r, const Vector3f &v) {
     return Vector3f(v.x * r, v.y * r, v.z * r);
   }
+#endif
+  float operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
   friend std::ostream &operator<<(std::ostream &os, const Vector3f &v) {
     return os << v.x << ", " << v.y << ", " << v.z;
   }
   float x, y, z;
+#ifdef RT_SIMD_ENABLED
+  float w;
+#endif
 };
 
 inline double length(const Vector3f &a){
@@ -62,6 +99,21 @@ inline Vector3f lerp(const Vector3f &a, const Vector3f &b, const float &t) {
   return a+(b-a)*t;
 }
 
+#ifdef RT_SIMD_ENABLED
+// rsqrt plus one Newton step instead of a double sqrt and a division
+inline Vector3f normalize(const Vector3f &v) {
+  float4 s = v.simd();
+  return s * rsqrt(dot3(s, s));
+}
+
+inline float dotProduct(const Vector3f &a, const Vector3f &b) {
+  return dot3(a.simd(), b.simd()).first();
+}
+
+inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b) {
+  return cross3(a.simd(), b.simd());
+}
+#else
 inline Vector3f normalize(const Vector3f &v) {
   return v/length(v);
 }
@@ -77,4 +129,4 @@ inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b) {
     ret.z=a.x*b.y-a.y*b.x;
     return ret;
 }
-
+#endif
@@ -0,0 +1,157 @@
+#pragma once
+#include "FrameBuffer.hpp"
+#include "Integrator.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One ray of a wavefront queue: where it goes, how much it contributes to its
+// pixel (the product of the Fresnel weights along its path) and its depth.
+struct WavefrontRay {
+  Vector3f orig;
+  Vector3f dir;
+  float weight;
+  uint32_t pixel; // y * width + x with y = 0 the top row
+  int depth;
+};
+
+// Breadth-first alternative to integrate(): every bounce is processed as one
+// batch through separate stages,
+//   intersect all rays -> bin the hits by MaterialType -> shade bin by bin
+//   -> accumulate into the frame and queue the spawned rays for the next bounce,
+// so each stage runs one kind of work over many rays. Stages run in parallel
+// over chunks of the batch; accumulation and queueing run in queue order, which
+// keeps the image independent of the thread count. Buffers are kept between
+// frames.
+class WavefrontIntegrator {
+public:
+  static constexpr size_t kChunkSize = 1024;
+
+  // empty queue to fill with the camera rays of the next render()
+  std::vector<WavefrontRay> &camera_rays() {
+    queue.clear();
+    return queue;
+  }
+
+  // Traces the camera rays to completion and adds the radiance of every ray
+  // into frame.at(pixel). frame is expected to be cleared.
+  void render(const Scene &scene, ThreadPool &pool, FrameBuffer &frame) {
+    if (scene.maxDepth < 0)
+      queue.clear();
+    while (!queue.empty()) {
+      intersect(scene, pool);
+      bin(scene);
+      shade_bins(scene, pool);
+      accumulate(scene, frame);
+      std::swap(queue, next);
+      next.clear();
+    }
+  }
+
+private:
+  // chunked parallel loop over [0, count)
+  template <typename F>
+  static void for_chunks(ThreadPool &pool, size_t count, F &&f) {
+    pool.parallel_for((count + kChunkSize - 1) / kChunkSize,
+                      [&](size_t chunk, unsigned) {
+                        const size_t end = std::min(count, (chunk + 1) * kChunkSize);
+                        for (size_t r = chunk * kChunkSize; r < end; ++r)
+                          f(r);
+                      });
+  }
+
+  void intersect(const Scene &scene, ThreadPool &pool) {
+    hits.resize(queue.size());
+    for_chunks(pool, queue.size(), [&](size_t r) {
+      if (!trace(queue[r].orig, queue[r].dir, scene, hits[r]))
+        hits[r].hit_obj = nullptr;
+    });
+  }
+
+  // counting sort of the ray indices: misses first, then one bin per MaterialType
+  void bin(const Scene &scene) {
+    for (auto &b : bin_start)
+      b = 0;
+    for (size_t r = 0; r < queue.size(); ++r)
+      ++bin_start[bin_of(scene, r) + 1];
+    for (int b = 0; b < kBins; ++b)
+      bin_start[b + 1] += bin_start[b];
+    order.resize(queue.size());
+    size_t fill[kBins];
+    std::copy(bin_start, bin_start + kBins, fill);
+    for (size_t r = 0; r < queue.size(); ++r)
+      order[fill[bin_of(scene, r)]++] = r;
+  }
+
+  void shade_bins(const Scene &scene, ThreadPool &pool) {
+    contribution.resize(queue.size());
+    spawned.resize(queue.size() * 2);
+    num_spawned.resize(queue.size());
+    for (int b = 0; b < kBins; ++b) {
+      const size_t first = bin_start[b], count = bin_start[b + 1] - first;
+      if (count == 0)
+        continue;
+      if (b == 0) {
+        for_chunks(pool, count, [&](size_t k) {
+          const size_t r = order[first + k];
+          contribution[r] = queue[r].weight * scene.backgroundColor;
+          num_spawned[r] = 0;
+        });
+        continue;
+      }
+      // the bin's kernel is picked once, outside the loop over its hits
+      with_material_type(MaterialType(b - 1), [&](auto type) {
+        with_light_count(scene.get_lights().size(), [&](auto lights) {
+          constexpr MaterialType kType = decltype(type)::value;
+          constexpr size_t kLights =
+              kType == DIFFUSE_AND_GLOSSY ? decltype(lights)::value : 0;
+          for_chunks(pool, count, [&](size_t k) {
+            const size_t r = order[first + k];
+            const WavefrontRay &ray = queue[r];
+            contribution[r] =
+                ray.weight * shade_kernel<kType, kLights>(
+                                 ray.orig, ray.dir, hits[r], scene,
+                                 &spawned[2 * r], num_spawned[r]);
+          });
+        });
+      });
+    }
+  }
+
+  // same culling rules as integrate()
+  void accumulate(const Scene &scene, FrameBuffer &frame) {
+    const int width = frame.get_width();
+    for (size_t r = 0; r < queue.size(); ++r) {
+      const WavefrontRay &ray = queue[r];
+      frame.at(ray.pixel % width, ray.pixel / width) += contribution[r];
+      for (int k = 0; k < num_spawned[r]; ++k) {
+        const SecondaryRay &s = spawned[2 * r + k];
+        const float weight = ray.weight * s.weight;
+        if (ray.depth + 1 > scene.maxDepth || weight < scene.minContribution)
+          continue;
+        RT_STAT_ADD(RefractionRays, s.refraction);
+        RT_STAT_ADD(ReflectionRays, !s.refraction);
+        next.push_back({s.orig, s.dir, weight, ray.pixel, ray.depth + 1});
+      }
+    }
+  }
+
+  // bin 0 holds the misses, bin 1 + t the hits on MaterialType t
+  static constexpr int kNumMaterialTypes = REFLECTION + 1;
+  static constexpr int kBins = 1 + kNumMaterialTypes;
+  int bin_of(const Scene &scene, size_t r) const {
+    if (!hits[r].hit_obj)
+      return 0;
+    return 1 + scene.get_material(hits[r].hit_obj->materialId).materialType;
+  }
+
+  std::vector<WavefrontRay> queue, next;
+  std::vector<hit_payload> hits;
+  std::vector<size_t> order;
+  size_t bin_start[kBins + 1] = {};
+  std::vector<Vector3f> contribution;
+  std::vector<SecondaryRay> spawned;
+  std::vector<int> num_spawned;
+};
@@ -0,0 +1,630 @@
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "SphereGroup.hpp"
+#include "Triangle.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Throughput benchmarks: micro benchmarks of the intersection routines on one
+// thread, then standard scenes, each timed per ray type (primary, shadow,
+// secondary) on the thread pool and as a whole frame. Every benchmark repeats
+// until --min-time seconds have passed and reports millions of rays per second.
+//   rtbench [--filter <text>] [--threads <n>] [--min-time <s>] [--json <file>]
+//           [--baseline <file>] [--tolerance <fraction>]
+// --json writes the results, one per line, to compare against later: with
+// --baseline the exit code is 2 when a benchmark got slower than the baseline
+// by more than the tolerance (default 0.1).
+
+RT_COUNT_ALLOCATIONS()
+
+namespace
+{
+
+struct Result
+{
+    std::string name;
+    double rays;
+    double seconds;
+    // heap allocations of one more frame once warmed up; RT_STATS frame benchmarks only
+    long long allocations = -1;
+    double mrays() const { return rays / seconds * 1e-6; }
+};
+
+struct Options
+{
+    std::string filter;
+    unsigned threads = std::thread::hardware_concurrency();
+    double minTime = 0.5;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+// runs f, which returns the number of rays it traced, until minTime has passed
+Result run(const std::string& name, double minTime, const std::function<double()>& f)
+{
+    f(); // warm up caches and lazily built buffers
+    double rays = 0;
+    const auto start = clock_type::now();
+    double seconds = 0;
+    do
+    {
+        rays += f();
+        seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    } while (seconds < minTime);
+    return {name, rays, seconds, -1};
+}
+
+// keeps results alive past the optimizer
+volatile float sink;
+
+// deterministic values in [lo, hi)
+struct Random
+{
+    Pcg32 rng;
+    float operator()(float lo, float hi) { return lo + (hi - lo) * rng.next_float(); }
+    Vector3f vec(float lo, float hi)
+    {
+        const float x = (*this)(lo, hi), y = (*this)(lo, hi);
+        return Vector3f(x, y, (*this)(lo, hi));
+    }
+};
+
+// camera ray through the center of pixel (i, j), i counted from the bottom, as Renderer casts them
+Vector3f camera_dir(const Scene& scene, int i, int j)
+{
+    const float h = std::tan(deg2rad(scene.camera.fov * 0.5f)), w = h * scene.width / (float)scene.height;
+    return normalize(Vector3f(((j + 0.5f) / scene.width * 2 - 1) * w, ((i + 0.5f) / scene.height * 2 - 1) * h, -1));
+}
+
+using SceneBuilder = std::function<void(Scene&)>;
+
+Material diffuse_material(const Vector3f& color)
+{
+    Material m;
+    m.diffuseColor = color;
+    return m;
+}
+
+Material glass_material()
+{
+    Material m;
+    m.ior = 1.5;
+    m.materialType = REFLECTION_AND_REFRACTION;
+    return m;
+}
+
+void add_floor(Scene& scene)
+{
+    Vector3f verts[4] = {{-50, -3, 0}, {50, -3, 0}, {50, -3, -100}, {-50, -3, -100}};
+    uint32_t vertIndex[6] = {0, 1, 3, 1, 2, 3};
+    Vector2f st[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    auto mesh = std::make_unique<MeshTriangle>(verts, vertIndex, 2, st);
+    mesh->materialId = scene.AddMaterial(Material());
+    scene.Add(std::move(mesh));
+}
+
+// the scene of main.cpp
+void demo_scene(Scene& scene)
+{
+    auto sph1 = std::make_unique<Sphere>(Vector3f(-1, 0, -12), 2);
+    sph1->materialId = scene.AddMaterial(diffuse_material(Vector3f(0.6, 0.7, 0.8)));
+    auto sph2 = std::make_unique<Sphere>(Vector3f(0.5, -0.5, -8), 1.5);
+    sph2->materialId = scene.AddMaterial(glass_material());
+    scene.Add(std::move(sph1));
+    scene.Add(std::move(sph2));
+    Vector3f verts[4] = {{-5, -3, -6}, {5, -3, -6}, {5, -3, -16}, {-5, -3, -16}};
+    uint32_t vertIndex[6] = {0, 1, 3, 1, 2, 3};
+    Vector2f st[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    auto mesh = std::make_unique<MeshTriangle>(verts, vertIndex, 2, st);
+    mesh->materialId = scene.AddMaterial(Material());
+    scene.Add(std::move(mesh));
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// 40 x 40 x 5 small spheres, every fourth one glass
+void spheres_scene(Scene& scene)
+{
+    const MaterialId materials[4] = {scene.AddMaterial(diffuse_material(Vector3f(0.8, 0.3, 0.3))),
+                                     scene.AddMaterial(diffuse_material(Vector3f(0.3, 0.8, 0.3))),
+                                     scene.AddMaterial(diffuse_material(Vector3f(0.3, 0.3, 0.8))),
+                                     scene.AddMaterial(glass_material())};
+    int k = 0;
+    for (int z = 0; z < 5; ++z)
+        for (int y = 0; y < 40; ++y)
+            for (int x = 0; x < 40; ++x, ++k)
+            {
+                auto sphere = std::make_unique<Sphere>(Vector3f(x - 19.5f, y * 0.5f - 2.5f, -10 - 4 * z), 0.2f);
+                sphere->materialId = materials[k % 4];
+                scene.Add(std::move(sphere));
+            }
+    add_floor(scene);
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// 100000 small diffuse spheres scattered in front of the camera
+constexpr int kNumParticles = 100000;
+
+void particles(std::vector<Vector3f>& centers, std::vector<float>& radii)
+{
+    Random random;
+    for (int k = 0; k < kNumParticles; ++k)
+    {
+        const Vector3f p = random.vec(0, 1);
+        centers.push_back(Vector3f(p.x * 24 - 12, p.y * 8 - 3, -8 - p.z * 24));
+        radii.push_back(random(0.03f, 0.08f));
+    }
+}
+
+// the particles as one Sphere each
+void particles_scene(Scene& scene)
+{
+    std::vector<Vector3f> centers;
+    std::vector<float> radii;
+    particles(centers, radii);
+    const MaterialId material = scene.AddMaterial(diffuse_material(Vector3f(0.8, 0.5, 0.3)));
+    for (int k = 0; k < kNumParticles; ++k)
+    {
+        auto sphere = std::make_unique<Sphere>(centers[k], radii[k]);
+        sphere->materialId = material;
+        scene.Add(std::move(sphere));
+    }
+    add_floor(scene);
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// the same particles in a single SphereGroup
+void particle_group_scene(Scene& scene)
+{
+    std::vector<Vector3f> centers;
+    std::vector<float> radii;
+    particles(centers, radii);
+    auto group = std::make_unique<SphereGroup>(std::move(centers), std::move(radii));
+    group->materialId = scene.AddMaterial(diffuse_material(Vector3f(0.8, 0.5, 0.3)));
+    scene.Add(std::move(group));
+    add_floor(scene);
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// 512 x 512 height field, 524288 triangles, with precomputed triangle storage
+void mesh_scene(Scene& scene)
+{
+    constexpr int n = 512;
+    std::vector<Vector3f> verts;
+    std::vector<Vector2f> st;
+    std::vector<uint32_t> indices;
+    verts.reserve((n + 1) * (n + 1));
+    st.reserve((n + 1) * (n + 1));
+    for (int z = 0; z <= n; ++z)
+        for (int x = 0; x <= n; ++x)
+        {
+            const float u = (float)x / n, v = (float)z / n;
+            verts.emplace_back(u * 30 - 15, std::sin(u * 25) * std::cos(v * 17) - 2, -5 - v * 30);
+            st.emplace_back(u * 8, v * 8);
+        }
+    indices.reserve(n * n * 6);
+    for (int z = 0; z < n; ++z)
+        for (int x = 0; x < n; ++x)
+        {
+            const uint32_t a = z * (n + 1) + x, b = a + 1, c = a + n + 1, d = c + 1;
+            for (uint32_t index : {a, b, c, b, d, c})
+                indices.push_back(index);
+        }
+    auto mesh = std::make_unique<MeshTriangle>(std::move(verts), std::move(indices), std::move(st),
+                                               TriangleStorage::Precomputed);
+    mesh->materialId = scene.AddMaterial(Material());
+    scene.Add(std::move(mesh));
+    auto sphere = std::make_unique<Sphere>(Vector3f(0, 1, -14), 2);
+    sphere->materialId = scene.AddMaterial(glass_material());
+    scene.Add(std::move(sphere));
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// nested glass shells, refracting through up to 12 bounces
+void refraction_scene(Scene& scene)
+{
+    const MaterialId glass = scene.AddMaterial(glass_material());
+    for (int k = 0; k < 4; ++k)
+    {
+        auto shell = std::make_unique<Sphere>(Vector3f(0, 0, -10), 4 - k * 0.8f);
+        shell->materialId = glass;
+        scene.Add(std::move(shell));
+    }
+    auto pair = std::make_unique<Sphere>(Vector3f(4, 1, -14), 2);
+    pair->materialId = glass;
+    scene.Add(std::move(pair));
+    add_floor(scene);
+    scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+    scene.maxDepth = 12;
+}
+
+// the demo scene lit by an 8 x 8 grid of lights
+void lights_scene(Scene& scene)
+{
+    demo_scene(scene);
+    for (int z = 0; z < 8; ++z)
+        for (int x = 0; x < 8; ++x)
+            scene.Add(std::make_unique<Light>(Vector3f(x * 10 - 35, 40, -z * 10 + 20), 1 / 64.f));
+}
+
+// the demo scene lit by a 16 x 16 grid of lights that reach 45 units each
+void many_lights_scene(Scene& scene)
+{
+    demo_scene(scene);
+    for (int z = 0; z < 16; ++z)
+        for (int x = 0; x < 16; ++x)
+            scene.Add(std::make_unique<Light>(Vector3f(x * 5 - 37.5f, 30, -z * 5 + 20), 1 / 32.f, 45.f));
+}
+
+// many_lights_scene() shading 8 sampled lights per hit
+void sampled_lights_scene(Scene& scene)
+{
+    many_lights_scene(scene);
+    scene.lightSamples = 8;
+}
+
+constexpr int kMicroRays = 4096;
+
+void micro_benchmarks(const Options& options, std::vector<Result>& results)
+{
+    Random random;
+    std::vector<Vector3f> orig(kMicroRays), dir(kMicroRays);
+    for (int k = 0; k < kMicroRays; ++k)
+    {
+        orig[k] = random.vec(-1, 1) + Vector3f(0, 0, 5);
+        dir[k] = normalize(random.vec(-0.3f, 0.3f) + Vector3f(0, 0, -1));
+    }
+
+    auto add = [&](const std::string& name, const std::function<double()>& f) {
+        if (name.find(options.filter) != std::string::npos)
+            results.push_back(run(name, options.minTime, f));
+    };
+
+    add("micro/solveQuadratic", [&] {
+        float sum = 0;
+        for (int k = 0; k < kMicroRays; ++k)
+        {
+            float x0, x1;
+            if (solveQuadratic(1, 2 * orig[k].x, dir[k].y, x0, x1))
+                sum += x0;
+        }
+        sink = sum;
+        return kMicroRays;
+    });
+
+    Sphere sphere(Vector3f(0), 1);
+    add("micro/Sphere::intersect", [&] {
+        float sum = 0;
+        for (int k = 0; k < kMicroRays; ++k)
+        {
+            float tNear = kInfinity;
+            uint32_t index;
+            Vector2f uv;
+            if (sphere.intersect(orig[k], dir[k], tNear, index, uv))
+                sum += tNear;
+        }
+        sink = sum;
+        return kMicroRays;
+    });
+
+    // eight spheres per ray, one at a time and as a SphereGroup8
+    SphereGroup8 group = {};
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        group.cx[lane] = (lane % 4) * 0.5f - 0.75f;
+        group.cy[lane] = (lane / 4) * 0.5f - 0.25f;
+        group.cz[lane] = -lane * 0.5f;
+        group.r2[lane] = 0.3f * 0.3f;
+        group.prim[lane] = lane;
+    }
+    add("micro/raySphereIntersect x8", [&] {
+        float sum = 0;
+        for (int k = 0; k < kMicroRays; ++k)
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                float tNear;
+                const Vector3f center(group.cx[lane], group.cy[lane], group.cz[lane]);
+                if (raySphereIntersect(orig[k], dir[k], center, group.r2[lane], tNear))
+                    sum += tNear;
+            }
+        sink = sum;
+        return kMicroRays;
+    });
+    add("micro/raySphereGroupIntersect", [&] {
+        float sum = 0;
+        for (int k = 0; k < kMicroRays; ++k)
+        {
+            float8 t;
+            const int lanes = raySphereGroupIntersect(group, SphereRay8(orig[k], dir[k]), kInfinity, t);
+            for (int lane = 0; lane < 8; ++lane)
+                if (lanes & (1 << lane))
+                    sum += t[lane];
+        }
+        sink = sum;
+        return kMicroRays;
+    });
+
+    const Vector3f p0(-1, -1, 0), p1(1, -1, 0), p2(0, 1, 0);
+    add("micro/rayTriangleIntersect", [&] {
+        float sum = 0;
+        for (int k = 0; k < kMicroRays; ++k)
+        {
+            float tNear, u, v;
+            if (rayTriangleIntersect(p0, p1, p2, orig[k], dir[k], tNear, u, v))
+                sum += tNear;
+        }
+        sink = sum;
+        return kMicroRays;
+    });
+
+    Scene scene(640, 480);
+    demo_scene(scene);
+    scene.compile();
+    add("micro/trace", [&] {
+        float sum = 0;
+        hit_payload payload;
+        for (int k = 0; k < kMicroRays; ++k)
+            if (trace(Vector3f(0), normalize(dir[k] + Vector3f(0, -0.2f, 0)), scene, payload))
+                sum += payload.tNear;
+        sink = sum;
+        return kMicroRays;
+    });
+}
+
+
+// Primary rays are the camera rays, secondary rays the mirror directions at
+// their hits and shadow rays go from the hits to every light.
+void scene_benchmarks(const Options& options, ThreadPool& pool, std::vector<Result>& results)
+{
+    const std::pair<const char*, SceneBuilder> scenes[] = {{"demo", demo_scene},
+                                                           {"spheres", spheres_scene},
+                                                           {"mesh", mesh_scene},
+                                                           {"refraction", refraction_scene},
+                                                           {"lights", lights_scene},
+                                                           {"manylights", many_lights_scene},
+                                                           {"sampledlights", sampled_lights_scene},
+                                                           {"particles", particles_scene},
+                                                           {"particlegroup", particle_group_scene}};
+    for (const auto& [sceneName, build] : scenes)
+    {
+        const std::string prefix = std::string("scene/") + sceneName + "/";
+        const char* kinds[] = {"primary", "shadow", "secondary", "frame"};
+        bool wanted = false;
+        for (const char* kind : kinds)
+            wanted |= (prefix + kind).find(options.filter) != std::string::npos;
+        if (!wanted)
+            continue;
+
+        Scene scene(640, 480);
+        build(scene);
+        scene.compile();
+        auto add = [&](const char* kind, const std::function<double()>& f) {
+            if ((prefix + kind).find(options.filter) != std::string::npos)
+                results.push_back(run(prefix + kind, options.minTime, f));
+        };
+
+        // primary hits, with the reflected direction for the secondary rays
+        const size_t numPixels = (size_t)scene.width * scene.height;
+        std::vector<Vector3f> hitPoint(numPixels), hitNormal(numPixels), reflected(numPixels);
+        std::vector<char> hit(numPixels);
+        pool.parallel_for(scene.height, [&](size_t i, unsigned) {
+            for (int j = 0; j < scene.width; ++j)
+            {
+                const size_t p = i * scene.width + j;
+                const Vector3f dir = camera_dir(scene, i, j);
+                hit_payload payload;
+                hit[p] = trace(Vector3f(0), dir, scene, payload);
+                if (!hit[p])
+                    continue;
+                Vector2f st;
+                hitPoint[p] = dir * payload.tNear;
+                payload.hit_obj->getSurfaceProperties(hitPoint[p], dir, payload.index, payload.uv, hitNormal[p], st);
+                reflected[p] = normalize(reflect(dir, hitNormal[p]));
+                hitPoint[p] = hitPoint[p] + hitNormal[p] * scene.epsilon;
+            }
+        });
+        size_t numHits = 0;
+        for (char h : hit)
+            numHits += h;
+
+        std::vector<float> rowSum(scene.height);
+        add("primary", [&] {
+            pool.parallel_for(scene.height, [&](size_t i, unsigned) {
+                float sum = 0;
+                hit_payload payload;
+                for (int j = 0; j < scene.width; ++j)
+                    if (trace(Vector3f(0), camera_dir(scene, i, j), scene, payload))
+                        sum += payload.tNear;
+                rowSum[i] = sum;
+            });
+            sink = rowSum[0];
+            return (double)numPixels;
+        });
+        add("shadow", [&] {
+            pool.parallel_for(scene.height, [&](size_t i, unsigned) {
+                float sum = 0;
+                for (int j = 0; j < scene.width; ++j)
+                {
+                    const size_t p = i * scene.width + j;
+                    if (!hit[p])
+                        continue;
+                    for (const auto& light : scene.get_lights())
+                    {
+                        const Vector3f toLight = light->position - hitPoint[p];
+                        const float distance = std::sqrt(dotProduct(toLight, toLight));
+                        sum += occluded(hitPoint[p], toLight / distance, distance, scene);
+                    }
+                }
+                rowSum[i] = sum;
+            });
+            sink = rowSum[0];
+            return (double)numHits * scene.get_lights().size();
+        });
+        add("secondary", [&] {
+            pool.parallel_for(scene.height, [&](size_t i, unsigned) {
+                float sum = 0;
+                hit_payload payload;
+                for (int j = 0; j < scene.width; ++j)
+                {
+                    const size_t p = i * scene.width + j;
+                    if (hit[p] && trace(hitPoint[p], reflected[p], scene, payload))
+                        sum += payload.tNear;
+                }
+                rowSum[i] = sum;
+            });
+            sink = rowSum[0];
+            return (double)numHits;
+        });
+
+        // whole frames through Renderer; counts camera rays only
+        Renderer renderer(options.threads);
+        renderer.set_output("/dev/null", ImageFormat::PPM);
+        add("frame", [&] {
+            renderer.Render(scene);
+            return (double)numPixels;
+        });
+#ifdef RT_STATS
+        if (!results.empty() && results.back().name == prefix + "frame")
+        {
+            renderer.RenderPass(scene, 0);
+            results.back().allocations = renderer.get_frame_stats().counters[(int)Stat::Allocations];
+        }
+#endif
+    }
+}
+
+void write_json(const std::string& path, const Options& options, const std::vector<Result>& results)
+{
+    std::ofstream out(path);
+    if (!out)
+        throw "bench error:cannot write json";
+#ifdef __OPTIMIZE__
+    const bool optimized = true;
+#else
+    const bool optimized = false;
+#endif
+#ifdef RT_SIMD
+    const bool simd = true;
+#else
+    const bool simd = false;
+#endif
+    out << "{\"optimized\": " << (optimized ? "true" : "false") << ", \"simd\": " << (simd ? "true" : "false")
+        << ", \"threads\": " << options.threads << ", \"results\": [\n";
+    for (size_t k = 0; k < results.size(); ++k)
+        out << "  {\"name\": \"" << results[k].name << "\", \"rays\": " << (long long)results[k].rays
+            << ", \"seconds\": " << results[k].seconds << ", \"mrays_per_s\": " << results[k].mrays() << "}"
+            << (k + 1 < results.size() ? ",\n" : "\n");
+    out << "]}\n";
+}
+
+// name -> Mrays/s of a file written by write_json()
+std::map<std::string, double> read_json(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw "bench error:cannot read baseline";
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        const size_t name = line.find("\"name\": \""), rate = line.find("\"mrays_per_s\": ");
+        if (name == std::string::npos || rate == std::string::npos)
+            continue;
+        const size_t begin = name + 9, end = line.find('"', begin);
+        baseline[line.substr(begin, end - begin)] = std::atof(line.c_str() + rate + 15);
+    }
+    return baseline;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::string jsonPath, baselinePath;
+    double tolerance = 0.1;
+    for (int k = 1; k < argc; ++k)
+    {
+        auto value = [&]() -> const char* {
+            if (k + 1 >= argc)
+            {
+                std::cerr << argv[k] << " needs a value\n";
+                std::exit(1);
+            }
+            return argv[++k];
+        };
+        if (!strcmp(argv[k], "--filter"))
+            options.filter = value();
+        else if (!strcmp(argv[k], "--threads"))
+            options.threads = std::max(1, std::atoi(value()));
+        else if (!strcmp(argv[k], "--min-time"))
+            options.minTime = std::atof(value());
+        else if (!strcmp(argv[k], "--json"))
+            jsonPath = value();
+        else if (!strcmp(argv[k], "--baseline"))
+            baselinePath = value();
+        else if (!strcmp(argv[k], "--tolerance"))
+            tolerance = std::atof(value());
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--filter <text>] [--threads <n>] [--min-time <s>] [--json <file>]"
+                         " [--baseline <file>] [--tolerance <fraction>]\n";
+            return 1;
+        }
+    }
+
+    try
+    {
+        std::map<std::string, double> baseline;
+        if (!baselinePath.empty())
+            baseline = read_json(baselinePath);
+
+        ThreadPool pool(options.threads);
+        std::vector<Result> results;
+        micro_benchmarks(options, results);
+        scene_benchmarks(options, pool, results);
+
+        int regressions = 0;
+        for (const Result& r : results)
+        {
+            std::printf("%-32s %10.2f Mrays/s", r.name.c_str(), r.mrays());
+            auto it = baseline.find(r.name);
+            if (it != baseline.end() && it->second > 0)
+            {
+                const double ratio = r.mrays() / it->second;
+                const bool slower = ratio < 1 - tolerance;
+                regressions += slower;
+                std::printf("  %+6.1f%%%s", (ratio - 1) * 100, slower ? "  REGRESSION" : "");
+            }
+            if (r.allocations >= 0)
+                std::printf("  %lld allocations/frame", r.allocations);
+            std::printf("\n");
+        }
+        if (!jsonPath.empty())
+            write_json(jsonPath, options, results);
+        return regressions ? 2 : 0;
+    }
+    catch (const char* error)
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+}
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
-#include <random>
+#include <limits>
 
 #define M_PI 3.14159265358979323846
 
+constexpr float kInfinity = std::numeric_limits<float>::max();
+
 
 inline float clamp(const float &lo, const float &hi, const float &v) {
   return std::max(lo, std::min(hi, v));
@@ -30,13 +34,60 @@ inline bool solveQuadratic(const float &a, const float &b, const float &c,
 
 enum MaterialType { DIFFUSE_AND_GLOSSY, REFLECTION_AND_REFRACTION, REFLECTION };
 
-inline float get_random_float() {
-  std::random_device dev;
-  std::mt19937 rng(dev());
-  std::uniform_real_distribution<float> dist(
-      0.f, 1.f); // distribution in range [1, 6]
+// Integer hash with full avalanche (lowbias32). Gives decorrelated values per
+// pixel and sample without any generator state.
+inline uint32_t hash_u32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// uniform in [0, 1) from the top 24 bits of hash_u32(x)
+inline float hash_float(uint32_t x) {
+  return (hash_u32(x) >> 8) * (1.f / 16777216.f);
+}
+
+// PCG32 (XSH RR variant): 16 bytes of state, a few cycles per number. stream
+// selects one of 2^63 independent sequences for the same seed.
+class Pcg32 {
+public:
+  explicit Pcg32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t stream = 0) {
+    set_sequence(seed, stream);
+  }
 
-  return dist(rng);
+  void set_sequence(uint64_t seed, uint64_t stream) {
+    state = 0;
+    inc = (stream << 1) | 1;
+    next_u32();
+    state += seed;
+    next_u32();
+  }
+
+  uint32_t next_u32() {
+    const uint64_t old = state;
+    state = old * 6364136223846793005ULL + inc;
+    const uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    const uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  // uniform in [0, 1)
+  float next_float() { return (next_u32() >> 8) * (1.f / 16777216.f); }
+
+private:
+  uint64_t state, inc;
+};
+
+// Uniform in [0, 1) from a generator owned by the calling thread; threads get
+// streams in the order they first call it. Renderers that need reproducible
+// images use a per pixel Sampler instead.
+inline float get_random_float() {
+  static std::atomic<uint64_t> next_stream{0};
+  thread_local Pcg32 rng(0x853c49e6748fea9bULL, next_stream++);
+  return rng.next_float();
 }
 
 inline void UpdateProgress(float progress) {
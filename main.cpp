@@ -3,21 +3,44 @@
 #include "Triangle.hpp"
 #include "Light.hpp"
 #include "Renderer.hpp"
+#include "SceneCache.hpp"
+#include "RenderServer.hpp"
+#include "Distributed.hpp"
 
-// In the main function of the program, we create the scene (create objects and lights)
-// as well as set the options for the render (image width and height, maximum recursion
-// depth, field-of-view, etc.). We then call the render function().
-int main()
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+RT_COUNT_ALLOCATIONS()
+
+// RT_STATS builds also write the frame's statistics and its cost heatmap
+static void write_render_stats(const Renderer& r)
 {
-    Scene scene(1280, 960);
+#ifdef RT_STATS
+    write_stats_json("stats.json", r.get_frame_stats());
+    r.write_cost_heatmap("cost.ppm");
+#else
+    (void)r;
+#endif
+}
+
+// the built-in scene: a diffuse and a glass sphere over a textured floor
+static void build_demo_scene(Scene& scene)
+{
+    Material diffuse;
+    diffuse.diffuseColor = Vector3f(0.6, 0.7, 0.8);
+    Material glass;
+    glass.ior = 1.5;
+    glass.materialType = REFLECTION_AND_REFRACTION;
 
     auto sph1 = std::make_unique<Sphere>(Vector3f(-1, 0, -12), 2);
-    sph1->materialType = DIFFUSE_AND_GLOSSY;
-    sph1->diffuseColor = Vector3f(0.6, 0.7, 0.8);
+    sph1->materialId = scene.AddMaterial(diffuse);
 
     auto sph2 = std::make_unique<Sphere>(Vector3f(0.5, -0.5, -8), 1.5);
-    sph2->ior = 1.5;
-    sph2->materialType = REFLECTION_AND_REFRACTION;
+    sph2->materialId = scene.AddMaterial(glass);
 
     scene.Add(std::move(sph1));
     scene.Add(std::move(sph2));
@@ -26,14 +49,126 @@ int main()
     uint32_t vertIndex[6] = {0, 1, 3, 1, 2, 3};
     Vector2f st[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
     auto mesh = std::make_unique<MeshTriangle>(verts, vertIndex, 2, st);
-    mesh->materialType = DIFFUSE_AND_GLOSSY;
+    mesh->materialId = scene.AddMaterial(Material());
 
     scene.Add(std::move(mesh));
     scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
-    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));    
+    scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+}
+
+// a scene cache written by obj2cache, lit by the demo lights if it has none
+static void load_cached_scene(const char* path, Scene& scene)
+{
+    load_scene_cache(path, scene);
+    if (scene.get_lights().empty())
+    {
+        scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
+        scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));
+    }
+}
+
+// In the main function of the program, we create the scene (create objects and lights)
+// as well as set the options for the render (image width and height, maximum recursion
+// depth, field-of-view, etc.). We then call the render function().
+// An optional argument names the output image; .ppm, .pfm and .png are supported.
+// A second one names a scene cache (see obj2cache) to render instead of the
+// built-in objects. With --serve as the first argument the program becomes a
+// RenderServer on stdin and stdout, for the built-in scene or the scene cache
+// named next. --turntable <frames> [prefix] renders the built-in scene from
+// frames cameras orbiting it into prefix000.ppm, prefix001.ppm and so on.
+// --worker <port> [address] makes the program a RenderWorker, listening on this
+// machine only unless address ("0.0.0.0" for every interface) says otherwise, and
+// --distribute <host:port,...> <samples> [output] [scene cache] renders on them.
+int main(int argc, char** argv)
+{
+    Scene scene(1280, 960);
+    if (argc > 2 && std::string(argv[1]) == "--turntable")
+    {
+        build_demo_scene(scene);
+        scene.compile();
+        const int numFrames = std::max(1, atoi(argv[2]));
+        const std::string prefix = argc > 3 ? argv[3] : "turntable";
+        // the first frame is the default view, about the middle of the spheres
+        const Vector3f center(0, 0, -10);
+        std::vector<BatchFrame> frames(numFrames);
+        for (int f = 0; f < numFrames; ++f)
+        {
+            const float angle = 2 * M_PI * f / numFrames;
+            frames[f].camera.LookAt(center + 10 * Vector3f(-std::sin(angle), 0, std::cos(angle)), center);
+            char index[16];
+            snprintf(index, sizeof(index), "%03d.ppm", f);
+            frames[f].path = prefix + index;
+        }
+        auto start = std::chrono::steady_clock::now();
+        Renderer r;
+        r.RenderBatch(scene, frames);
+        std::cout << numFrames << " frames in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                  << " ms\n";
+        return 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--worker")
+    {
+        Renderer r;
+        RenderWorker(r).Listen(atoi(argv[2]), argc > 3 ? argv[3] : "127.0.0.1");
+        return 0;
+    }
+    if (argc > 3 && std::string(argv[1]) == "--distribute")
+    {
+        std::vector<std::string> workers;
+        std::stringstream list(argv[2]);
+        for (std::string address; std::getline(list, address, ',');)
+            workers.push_back(address);
+        if (argc > 5)
+            load_cached_scene(argv[5], scene);
+        else
+            build_demo_scene(scene);
+        RenderCoordinator coordinator(workers);
+        auto start = std::chrono::steady_clock::now();
+        coordinator.SetScene(scene);
+        FrameBuffer frame;
+        const DistributedStats stats = coordinator.Render(scene, atoi(argv[3]), frame);
+        const std::string output = argc > 4 ? argv[4] : "binary.ppm";
+        write_image(output, frame, image_format_from_path(output));
+        std::cout << stats.units << " units on " << coordinator.get_num_workers() << " workers in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                  << " ms\n";
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--serve")
+    {
+        if (argc > 2)
+            load_cached_scene(argv[2], scene);
+        else
+            build_demo_scene(scene);
+        scene.compile();
+        Renderer r;
+        RenderServer(scene, r).Serve(std::cin, std::cout);
+        return 0;
+    }
+    if (argc > 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        load_cached_scene(argv[2], scene);
+        scene.compile();
+        Renderer r;
+        r.set_output(argv[1]);
+        std::cout << "scene ready in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                  << " ms\n";
+        r.Render(scene);
+        write_render_stats(r);
+        return 0;
+    }
+
+    build_demo_scene(scene);
+    scene.compile();
 
     Renderer r;
+    if (argc > 1)
+        r.set_output(argv[1]);
     r.Render(scene);
+    write_render_stats(r);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "MeshLoader.hpp"
+#include "SceneCache.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Converts an OBJ or PLY file into a binary scene cache holding one mesh with the
+// default material and its prebuilt BVH. Render it with
+//   RayTracing <image> <cache>
+int main(int argc, char** argv)
+{
+    if (argc < 3 || (argc == 4 && strcmp(argv[3], "--precomputed") != 0) || argc > 4)
+    {
+        std::cerr << "usage: " << argv[0] << " <input.obj|input.ply> <output.rtsc> [--precomputed]\n";
+        return 1;
+    }
+    try
+    {
+        auto start = std::chrono::steady_clock::now();
+        ThreadPool pool;
+        MeshData data = load_mesh(argv[1], pool);
+        if (data.indices.empty())
+            throw "load mesh error:no faces";
+        const size_t numTris = data.indices.size() / 3, numVertices = data.vertices.size();
+        auto parsed = std::chrono::steady_clock::now();
+
+        Scene scene(1, 1);
+        scene.Add(std::make_unique<MeshTriangle>(std::move(data.vertices), std::move(data.indices),
+                                                 std::move(data.st),
+                                                 argc == 4 ? TriangleStorage::Precomputed : TriangleStorage::Indexed));
+        auto built = std::chrono::steady_clock::now();
+        write_scene_cache(argv[2], scene);
+        auto written = std::chrono::steady_clock::now();
+
+        auto ms = [](auto a, auto b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+        std::cout << numTris << " triangles, " << numVertices << " vertices: parse " << ms(start, parsed)
+                  << " ms, BVH " << ms(parsed, built) << " ms, write " << ms(built, written) << " ms\n";
+    }
+    catch (const char* error)
+    {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    return 0;
+}